@@ -0,0 +1,92 @@
+
+// Free list growth benchmark.
+//
+// Fragments the heap by allocating pairs of small chunks and freeing
+// one chunk of each pair, so the allocator holds N free chunks that
+// are too small for the request being measured. Then times a run of
+// larger allocations. A first-fit allocator walks every hole on each
+// call, so its latency grows with N; a size-class allocator should
+// stay flat. Each measurement is the best of REPS timed runs, after a
+// warm-up run, so page faults on fresh memory are not counted.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "xmalloc.h"
+
+#define ROUNDS    10000
+#define HOLE_SIZE 16
+#define REQ_SIZE  200
+#define REPS      5
+
+static
+double
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static
+double
+measure(long holes)
+{
+    // Bookkeeping arrays come from the system so they do not disturb
+    // the heap under test.
+    void** keep = malloc(2 * holes * sizeof(void*));
+    void** reqs = malloc(ROUNDS * sizeof(void*));
+
+    for (long ii = 0; ii < 2 * holes; ++ii) {
+        keep[ii] = xmalloc(HOLE_SIZE);
+    }
+    for (long ii = 0; ii < holes; ++ii) {
+        xfree(keep[2 * ii]);
+    }
+
+    double best = -1;
+    for (int rr = 0; rr <= REPS; ++rr) {
+        double t0 = now_ns();
+        for (long ii = 0; ii < ROUNDS; ++ii) {
+            reqs[ii] = xmalloc(REQ_SIZE);
+        }
+        double t1 = now_ns();
+
+        for (long ii = 0; ii < ROUNDS; ++ii) {
+            xfree(reqs[ii]);
+        }
+        if (rr > 0 && (best < 0 || t1 - t0 < best)) {
+            best = t1 - t0;
+        }
+    }
+
+    for (long ii = 0; ii < holes; ++ii) {
+        xfree(keep[2 * ii + 1]);
+    }
+    free(reqs);
+    free(keep);
+
+    return best / ROUNDS;
+}
+
+int
+main(int argc, char* argv[])
+{
+    long max_holes = 64000;
+    if (argc > 2) {
+        printf("Usage:\n");
+        printf("\t%s [MAX_HOLES]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2) {
+        max_holes = atol(argv[1]);
+    }
+
+    printf("holes,ns_per_alloc\n");
+    for (long holes = 1000; holes <= max_holes; holes *= 2) {
+        printf("%ld,%.1f\n", holes, measure(holes));
+    }
+
+    return 0;
+}
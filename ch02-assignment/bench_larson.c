@@ -0,0 +1,104 @@
+
+// Larson-style benchmark.
+//
+// Runs THREADS workers, each owning an array of SLOTS live objects of
+// random sizes between 16 and 512 bytes. A worker repeatedly frees a
+// random object and puts a fresh allocation in its place. After
+// OPS_PER_ROUND replacements it exits and hands its array to a new
+// thread, which goes on replacing objects the old thread allocated, so
+// objects outlive their threads and are freed by other ones, as in a
+// server handing connections between worker threads. Reports operations
+// (one free plus one malloc) per second, overall and per thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include <time.h>
+
+#include "xmalloc.h"
+
+#define SLOTS       1000
+#define ROUNDS      10
+#define MAX_THREADS 256
+
+typedef struct larson_arg {
+    void* live[SLOTS];
+    unsigned int seed;
+} larson_arg;
+
+static long ops_per_round = 100000;
+static larson_arg args[MAX_THREADS];
+
+static
+double
+now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void*
+worker(void* arg)
+{
+    larson_arg* la = (larson_arg*) arg;
+    for (long ii = 0; ii < ops_per_round; ++ii) {
+        int slot = rand_r(&(la->seed)) % SLOTS;
+        xfree(la->live[slot]);
+        la->live[slot] = xmalloc(16 + rand_r(&(la->seed)) % 497);
+    }
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    pthread_t threads[MAX_THREADS];
+    int nthreads = 4;
+    int rv;
+
+    if (argc > 3) {
+        printf("Usage:\n");
+        printf("\t%s [THREADS] [OPS_PER_ROUND]\n", argv[0]);
+        return 1;
+    }
+    if (argc >= 2) {
+        nthreads = atoi(argv[1]);
+        assert(nthreads > 0 && nthreads <= MAX_THREADS);
+    }
+    if (argc == 3) {
+        ops_per_round = atol(argv[2]);
+    }
+
+    for (int tt = 0; tt < nthreads; ++tt) {
+        args[tt].seed = tt + 1;
+        for (int ii = 0; ii < SLOTS; ++ii) {
+            args[tt].live[ii] = xmalloc(16 + rand_r(&(args[tt].seed)) % 497);
+        }
+    }
+
+    double t0 = now_s();
+    for (int rr = 0; rr < ROUNDS; ++rr) {
+        for (int tt = 0; tt < nthreads; ++tt) {
+            rv = pthread_create(&(threads[tt]), 0, worker, &(args[tt]));
+            assert(rv == 0);
+        }
+        for (int tt = 0; tt < nthreads; ++tt) {
+            rv = pthread_join(threads[tt], 0);
+            assert(rv == 0);
+        }
+    }
+    double t1 = now_s();
+
+    for (int tt = 0; tt < nthreads; ++tt) {
+        for (int ii = 0; ii < SLOTS; ++ii) {
+            xfree(args[tt].live[ii]);
+        }
+    }
+
+    double ops = (double) nthreads * ROUNDS * ops_per_round / (t1 - t0);
+    printf("threads,ops_per_sec,ops_per_sec_per_thread\n");
+    printf("%d,%.0f,%.0f\n", nthreads, ops, ops / nthreads);
+    return 0;
+}
@@ -0,0 +1,117 @@
+
+// List copy benchmark.
+//
+// Builds a list of LENGTH cells, then repeatedly copies and frees it,
+// once a cell at a time with xmalloc and xfree and once with copy_list
+// and free_list from list.h, which allocate and free cells in batches.
+// Reports nanoseconds per cell copied and freed for each, the best of
+// REPS runs after a warm-up run, for lengths from 16 cells upwards.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "list.h"
+
+#define REPS 5
+
+static long total_cells = 4000000;
+
+static
+double
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static
+cell*
+copy_single(cell* xs)
+{
+    cell* ys = 0;
+    cell** tail = &ys;
+    for (; xs; xs = xs->rest) {
+        cell* zs = xmalloc(sizeof(cell));
+        zs->item = xs->item;
+        *tail = zs;
+        tail = &(zs->rest);
+    }
+    *tail = 0;
+    return ys;
+}
+
+static
+void
+free_single(cell* xs)
+{
+    while (xs) {
+        cell* ys = xs->rest;
+        xfree(xs);
+        xs = ys;
+    }
+}
+
+static
+void
+copy_free_single(cell* xs)
+{
+    free_single(copy_single(xs));
+}
+
+static
+void
+copy_free_batch(cell* xs)
+{
+    free_list(copy_list(xs));
+}
+
+static
+double
+measure(void (*copy_free)(cell*), cell* xs, long length)
+{
+    long rounds = total_cells / length;
+    double best = -1;
+    for (int rr = 0; rr <= REPS; ++rr) {
+        double t0 = now_ns();
+        for (long ii = 0; ii < rounds; ++ii) {
+            copy_free(xs);
+        }
+        double t1 = now_ns();
+        if (rr > 0 && (best < 0 || t1 - t0 < best)) {
+            best = t1 - t0;
+        }
+    }
+    return best / (rounds * length);
+}
+
+int
+main(int argc, char* argv[])
+{
+    long max_length = 100000;
+    if (argc > 2) {
+        printf("Usage:\n");
+        printf("\t%s [MAX_LENGTH]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2) {
+        max_length = atol(argv[1]);
+    }
+
+    printf("length,single_ns_per_cell,batch_ns_per_cell\n");
+    for (long length = 16; length <= max_length; length *= 4) {
+        cell* xs = 0;
+        for (long ii = 0; ii < length; ++ii) {
+            xs = cons(ii, xs);
+        }
+
+        double ts = measure(copy_free_single, xs, length);
+        double tb = measure(copy_free_batch, xs, length);
+        printf("%ld,%.1f,%.1f\n", length, ts, tb);
+
+        free_single(xs);
+    }
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+
+// Mixed size benchmark.
+//
+// Runs THREADS workers, each keeping a working set of WSET live objects
+// and repeatedly replacing a random one. Sizes are drawn from a skewed
+// mix like a typical program's: most requests are tiny, some are small
+// or medium, and a few are large enough to need their own pages.
+// Reports operations (one free plus one malloc) per second, overall and
+// per thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include "xmalloc.h"
+
+#define WSET        512
+#define MAX_THREADS 256
+
+static long ops_per_thread = 200000;
+
+static
+double
+now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 70% up to 64 bytes, 20% up to 1 KB, 9% up to 4 KB, 1% up to 256 KB.
+static
+size_t
+pick_size(unsigned int* seed)
+{
+    int roll = rand_r(seed) % 100;
+    if (roll < 70) {
+        return 8 + rand_r(seed) % 57;
+    }
+    if (roll < 90) {
+        return 65 + rand_r(seed) % 960;
+    }
+    if (roll < 99) {
+        return 1025 + rand_r(seed) % 3072;
+    }
+    return 4097 + rand_r(seed) % (256 * 1024 - 4096);
+}
+
+void*
+worker(void* arg)
+{
+    unsigned int seed = (unsigned int) (long) arg;
+    void* live[WSET] = { 0 };
+
+    for (long ii = 0; ii < ops_per_thread; ++ii) {
+        int slot = rand_r(&seed) % WSET;
+        if (live[slot] != 0) {
+            xfree(live[slot]);
+        }
+        size_t size = pick_size(&seed);
+        live[slot] = xmalloc(size);
+        memset(live[slot], 0, size < 64 ? size : 64);
+    }
+
+    for (int ii = 0; ii < WSET; ++ii) {
+        if (live[ii] != 0) {
+            xfree(live[ii]);
+        }
+    }
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    pthread_t threads[MAX_THREADS];
+    int nthreads = 4;
+    int rv;
+
+    if (argc > 3) {
+        printf("Usage:\n");
+        printf("\t%s [THREADS] [OPS_PER_THREAD]\n", argv[0]);
+        return 1;
+    }
+    if (argc >= 2) {
+        nthreads = atoi(argv[1]);
+        assert(nthreads > 0 && nthreads <= MAX_THREADS);
+    }
+    if (argc == 3) {
+        ops_per_thread = atol(argv[2]);
+    }
+
+    double t0 = now_s();
+    for (long tt = 0; tt < nthreads; ++tt) {
+        rv = pthread_create(&(threads[tt]), 0, worker, (void*) (tt + 1));
+        assert(rv == 0);
+    }
+    for (int tt = 0; tt < nthreads; ++tt) {
+        rv = pthread_join(threads[tt], 0);
+        assert(rv == 0);
+    }
+    double t1 = now_s();
+
+    double ops = (double) nthreads * ops_per_thread / (t1 - t0);
+    printf("threads,ops_per_sec,ops_per_sec_per_thread\n");
+    printf("%d,%.0f,%.0f\n", nthreads, ops, ops / nthreads);
+    return 0;
+}
@@ -0,0 +1,94 @@
+
+// Thread oversubscription benchmark.
+//
+// Runs THREADS workers, typically several times the number of cores.
+// Each worker keeps a working set of WSET live objects and repeatedly
+// replaces a random one with a fresh allocation of a random small size.
+// Reports operations (one free plus one malloc) per second and the
+// peak resident set size, which shows how much memory per-thread
+// caches cost when threads outnumber cores.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "xmalloc.h"
+
+#define WSET        256
+#define MAX_THREADS 4096
+
+static long ops_per_thread = 200000;
+
+static
+double
+now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void*
+worker(void* arg)
+{
+    unsigned int seed = (unsigned int) (long) arg;
+    void* live[WSET] = { 0 };
+
+    for (long ii = 0; ii < ops_per_thread; ++ii) {
+        int slot = rand_r(&seed) % WSET;
+        if (live[slot] != 0) {
+            xfree(live[slot]);
+        }
+        live[slot] = xmalloc(16 + rand_r(&seed) % 497);
+    }
+
+    for (int ii = 0; ii < WSET; ++ii) {
+        if (live[ii] != 0) {
+            xfree(live[ii]);
+        }
+    }
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    static pthread_t threads[MAX_THREADS];
+    int nthreads = 4 * sysconf(_SC_NPROCESSORS_ONLN);
+    int rv;
+
+    if (argc > 3) {
+        printf("Usage:\n");
+        printf("\t%s [THREADS] [OPS_PER_THREAD]\n", argv[0]);
+        return 1;
+    }
+    if (argc >= 2) {
+        nthreads = atoi(argv[1]);
+        assert(nthreads > 0 && nthreads <= MAX_THREADS);
+    }
+    if (argc == 3) {
+        ops_per_thread = atol(argv[2]);
+    }
+
+    double t0 = now_s();
+    for (long ii = 0; ii < nthreads; ++ii) {
+        rv = pthread_create(&(threads[ii]), 0, worker, (void*) (ii + 1));
+        assert(rv == 0);
+    }
+    for (int ii = 0; ii < nthreads; ++ii) {
+        rv = pthread_join(threads[ii], 0);
+        assert(rv == 0);
+    }
+    double t1 = now_s();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("threads,ops_per_sec,maxrss_kb\n");
+    printf("%d,%.0f,%ld\n", nthreads, nthreads * ops_per_thread / (t1 - t0), usage.ru_maxrss);
+    return 0;
+}
@@ -0,0 +1,104 @@
+
+// Allocation fast path benchmark.
+//
+// Times back-to-back xmalloc and xfree_sized pairs of one size, and the
+// same with DEPTH objects live at once, so every call is served from
+// the thread cache. Reports cycles per alloc+free pair (nanoseconds
+// where there is no cycle counter), the best of REPS runs after a
+// warm-up run. bench-pair-par calls into the allocator for each
+// operation; bench-pair-inline builds the same source with OPT_INLINE,
+// so the cache hits are inlined from optmalloc.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "xmalloc.h"
+
+#define REPS  5
+#define DEPTH 32
+
+static long pairs = 4000000;
+static const size_t sizes[] = { 16, 64, 256, 1024 };
+
+static
+uint64_t
+now_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+#endif
+}
+
+static
+void
+run_single(size_t size)
+{
+    for (long ii = 0; ii < pairs; ++ii) {
+        long* item = xmalloc(size);
+        item[0] = ii;
+        xfree_sized(item, size);
+    }
+}
+
+static
+void
+run_depth(size_t size)
+{
+    long* items[DEPTH];
+    for (long ii = 0; ii < pairs; ii += DEPTH) {
+        for (int jj = 0; jj < DEPTH; ++jj) {
+            items[jj] = xmalloc(size);
+            items[jj][0] = ii;
+        }
+        for (int jj = DEPTH - 1; jj >= 0; --jj) {
+            xfree_sized(items[jj], size);
+        }
+    }
+}
+
+static
+double
+measure(void (*run)(size_t), size_t size)
+{
+    uint64_t best = 0;
+    for (int rr = 0; rr <= REPS; ++rr) {
+        uint64_t t0 = now_cycles();
+        run(size);
+        uint64_t t1 = now_cycles();
+        if (rr > 0 && (best == 0 || t1 - t0 < best)) {
+            best = t1 - t0;
+        }
+    }
+    return (double) best / pairs;
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (argc > 2) {
+        printf("Usage:\n");
+        printf("\t%s [PAIRS]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2) {
+        pairs = atol(argv[1]);
+    }
+
+    printf("size,cycles_per_pair,cycles_per_pair_depth%d\n", DEPTH);
+    for (size_t ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+        double t1 = measure(run_single, sizes[ii]);
+        double td = measure(run_depth, sizes[ii]);
+        printf("%zu,%.1f,%.1f\n", sizes[ii], t1, td);
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+
+// Realloc churn benchmark.
+//
+// Runs THREADS workers, each holding BUFS buffers. A worker repeatedly
+// picks a random buffer and reallocs it to a random size between 1 KB
+// and 1 MB, so buffers keep growing and shrinking across the small,
+// medium and large paths. The first and last word of each buffer are
+// checked to make sure realloc kept the contents. Reports reallocs per
+// second, overall and per thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include <time.h>
+
+#include "xmalloc.h"
+
+#define BUFS        16
+#define MIN_SIZE    1024
+#define MAX_SIZE    (1024 * 1024)
+#define MAX_THREADS 256
+
+static long ops_per_thread = 20000;
+
+static
+double
+now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void*
+worker(void* arg)
+{
+    unsigned int seed = (unsigned int) (long) arg;
+    long* bufs[BUFS];
+    size_t sizes[BUFS];
+
+    for (int ii = 0; ii < BUFS; ++ii) {
+        sizes[ii] = MIN_SIZE;
+        bufs[ii] = xmalloc(MIN_SIZE);
+        bufs[ii][0] = ii;
+        bufs[ii][MIN_SIZE / sizeof(long) - 1] = ii;
+    }
+
+    for (long op = 0; op < ops_per_thread; ++op) {
+        int ii = rand_r(&seed) % BUFS;
+        size_t size = MIN_SIZE + rand_r(&seed) % (MAX_SIZE - MIN_SIZE);
+        bufs[ii] = xrealloc(bufs[ii], size);
+        assert(bufs[ii][0] == ii);
+        if (size >= sizes[ii]) {
+            assert(bufs[ii][sizes[ii] / sizeof(long) - 1] == ii);
+        }
+
+        sizes[ii] = size;
+        bufs[ii][size / sizeof(long) - 1] = ii;
+    }
+
+    for (int ii = 0; ii < BUFS; ++ii) {
+        xfree(bufs[ii]);
+    }
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    pthread_t threads[MAX_THREADS];
+    int nthreads = 4;
+    int rv;
+
+    if (argc > 3) {
+        printf("Usage:\n");
+        printf("\t%s [THREADS] [OPS_PER_THREAD]\n", argv[0]);
+        return 1;
+    }
+    if (argc >= 2) {
+        nthreads = atoi(argv[1]);
+        assert(nthreads > 0 && nthreads <= MAX_THREADS);
+    }
+    if (argc == 3) {
+        ops_per_thread = atol(argv[2]);
+    }
+
+    double t0 = now_s();
+    for (long tt = 0; tt < nthreads; ++tt) {
+        rv = pthread_create(&(threads[tt]), 0, worker, (void*) (tt + 1));
+        assert(rv == 0);
+    }
+    for (int tt = 0; tt < nthreads; ++tt) {
+        rv = pthread_join(threads[tt], 0);
+        assert(rv == 0);
+    }
+    double t1 = now_s();
+
+    double ops = (double) nthreads * ops_per_thread / (t1 - t0);
+    printf("threads,ops_per_sec,ops_per_sec_per_thread\n");
+    printf("%d,%.0f,%.0f\n", nthreads, ops, ops / nthreads);
+    return 0;
+}
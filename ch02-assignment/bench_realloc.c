@@ -0,0 +1,98 @@
+
+// Realloc growth benchmark.
+//
+// For each buffer size from 4 KB up to a maximum (1 GB by default),
+// fills a buffer of that size and times growing it to twice the size,
+// once with xrealloc and once with the copy path (xmalloc, memcpy,
+// xfree). Each time is the best of REPS runs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xmalloc.h"
+
+#define REPS 3
+
+static
+double
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static
+double
+grow_realloc(size_t bytes)
+{
+    char* buf = xmalloc(bytes);
+    memset(buf, 1, bytes);
+
+    double t0 = now_ns();
+    buf = xrealloc(buf, 2 * bytes);
+    double t1 = now_ns();
+
+    if (buf[bytes - 1] != 1) {
+        printf("realloc lost data at %ld bytes\n", bytes);
+        exit(1);
+    }
+    xfree(buf);
+    return t1 - t0;
+}
+
+static
+double
+grow_copy(size_t bytes)
+{
+    char* buf = xmalloc(bytes);
+    memset(buf, 1, bytes);
+
+    double t0 = now_ns();
+    char* bigger = xmalloc(2 * bytes);
+    memcpy(bigger, buf, bytes);
+    xfree(buf);
+    double t1 = now_ns();
+
+    xfree(bigger);
+    return t1 - t0;
+}
+
+static
+double
+best_of(double (*grow)(size_t), size_t bytes)
+{
+    double best = -1;
+    for (int rr = 0; rr < REPS; ++rr) {
+        double tt = grow(bytes);
+        if (best < 0 || tt < best) {
+            best = tt;
+        }
+    }
+    return best;
+}
+
+int
+main(int argc, char* argv[])
+{
+    size_t max_bytes = 1UL << 30;
+    if (argc > 2) {
+        printf("Usage:\n");
+        printf("\t%s [MAX_BYTES]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2) {
+        max_bytes = atol(argv[1]);
+    }
+
+    printf("bytes,realloc_us,copy_us\n");
+    for (size_t bytes = 4096; bytes <= max_bytes; bytes *= 2) {
+        double tr = best_of(grow_realloc, bytes);
+        double tc = best_of(grow_copy, bytes);
+        printf("%ld,%.1f,%.1f\n", bytes, tr / 1000, tc / 1000);
+    }
+
+    return 0;
+}
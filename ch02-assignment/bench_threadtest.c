@@ -0,0 +1,88 @@
+
+// Threadtest-style benchmark.
+//
+// Runs THREADS workers. Each one repeatedly allocates a batch of BATCH
+// objects of OBJ_SIZE bytes and then frees the whole batch, so the
+// allocator sees long runs of mallocs followed by long runs of frees on
+// every thread at once. Reports operations (one malloc plus one free)
+// per second, overall and per thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include <time.h>
+
+#include "xmalloc.h"
+
+#define BATCH       10000
+#define MAX_THREADS 256
+
+static long batches = 100;
+static size_t obj_size = 64;
+
+static
+double
+now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void*
+worker(void* _arg)
+{
+    static __thread void* objs[BATCH];
+    for (long bb = 0; bb < batches; ++bb) {
+        for (int ii = 0; ii < BATCH; ++ii) {
+            objs[ii] = xmalloc(obj_size);
+            *((long*) objs[ii]) = ii;
+        }
+        for (int ii = 0; ii < BATCH; ++ii) {
+            xfree(objs[ii]);
+        }
+    }
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    pthread_t threads[MAX_THREADS];
+    int nthreads = 4;
+    int rv;
+
+    if (argc > 4) {
+        printf("Usage:\n");
+        printf("\t%s [THREADS] [BATCHES] [OBJ_SIZE]\n", argv[0]);
+        return 1;
+    }
+    if (argc >= 2) {
+        nthreads = atoi(argv[1]);
+        assert(nthreads > 0 && nthreads <= MAX_THREADS);
+    }
+    if (argc >= 3) {
+        batches = atol(argv[2]);
+    }
+    if (argc == 4) {
+        obj_size = atol(argv[3]);
+        assert(obj_size >= sizeof(long));
+    }
+
+    double t0 = now_s();
+    for (int tt = 0; tt < nthreads; ++tt) {
+        rv = pthread_create(&(threads[tt]), 0, worker, 0);
+        assert(rv == 0);
+    }
+    for (int tt = 0; tt < nthreads; ++tt) {
+        rv = pthread_join(threads[tt], 0);
+        assert(rv == 0);
+    }
+    double t1 = now_s();
+
+    double ops = (double) nthreads * batches * BATCH / (t1 - t0);
+    printf("threads,ops_per_sec,ops_per_sec_per_thread\n");
+    printf("%d,%.0f,%.0f\n", nthreads, ops, ops / nthreads);
+    return 0;
+}
@@ -0,0 +1,121 @@
+
+// TLB miss benchmark.
+//
+// Grows an ivec to SIZE_MB megabytes with ivec_push, so the buffer is
+// built the way collatz-ivec builds its vectors, then makes ACCESSES
+// dependent reads at random places in it. Reports nanoseconds per read,
+// the dTLB load misses counted by perf (-1 where perf events are not
+// available) and how much of the process the kernel backed with huge
+// pages. Run the par build with OPTMALLOC_HUGEPAGES=0 and =1 to see
+// what huge pages save.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "ivec.h"
+
+#define ACCESSES 20000000
+
+static
+double
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static
+int
+open_dtlb_counter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static
+long
+anon_huge_kb()
+{
+    FILE* fh = fopen("/proc/self/smaps_rollup", "r");
+    if (fh == 0) {
+        return -1;
+    }
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), fh)) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(fh);
+    return kb;
+}
+
+int
+main(int argc, char* argv[])
+{
+    long size_mb = 512;
+    if (argc > 2) {
+        printf("Usage:\n");
+        printf("\t%s [SIZE_MB]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2) {
+        size_mb = atol(argv[1]);
+    }
+
+    long count = size_mb * (1L << 20) / sizeof(long);
+    ivec* xs = make_ivec(4);
+    for (long ii = 0; ii < count; ++ii) {
+        ivec_push(xs, ii);
+    }
+
+    int fd = open_dtlb_counter();
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    // each read's index depends on the last, so misses are not overlapped.
+    unsigned long state = 1;
+    long sum = 0;
+    double t0 = now_ns();
+    for (long ii = 0; ii < ACCESSES; ++ii) {
+        state = state * 6364136223846793005UL + 1442695040888963407UL + sum;
+        sum += xs->data[(state >> 17) % count] & 1;
+    }
+    double t1 = now_ns();
+
+    long misses = -1;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) {
+            misses = -1;
+        }
+        close(fd);
+    }
+
+    printf("size_mb,ns_per_read,dtlb_misses,anon_huge_kb,checksum\n");
+    printf("%ld,%.1f,%ld,%ld,%ld\n", size_mb, (t1 - t0) / ACCESSES, misses,
+           anon_huge_kb(), sum);
+
+    free_ivec(xs);
+    return 0;
+}
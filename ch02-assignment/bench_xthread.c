@@ -0,0 +1,114 @@
+
+// Cross-thread free benchmark.
+//
+// Runs PAIRS producer/consumer pairs. Each producer allocates objects
+// of mixed small sizes and hands them through a single-producer,
+// single-consumer ring to its consumer, which frees them. Every free
+// therefore happens on a different thread than the allocation.
+// Reports pairs of alloc+free per second, overall and per thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sched.h>
+#include <time.h>
+
+#include "xmalloc.h"
+
+#define RING_SIZE 1024
+#define MAX_PAIRS 64
+
+typedef struct ring {
+    void* slots[RING_SIZE];
+    long  head;
+    long  tail;
+} ring;
+
+static long ops_per_pair = 1000000;
+static ring rings[MAX_PAIRS];
+
+static const size_t sizes[] = { 16, 24, 32, 48, 64, 128, 256, 512 };
+
+static
+double
+now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void*
+producer(void* arg)
+{
+    ring* rr = (ring*) arg;
+    for (long ii = 0; ii < ops_per_pair; ++ii) {
+        long* item = xmalloc(sizes[ii % 8]);
+        item[0] = ii;
+
+        long head = rr->head;
+        while (head - __atomic_load_n(&(rr->tail), __ATOMIC_ACQUIRE) == RING_SIZE) {
+            sched_yield();
+        }
+        rr->slots[head % RING_SIZE] = item;
+        __atomic_store_n(&(rr->head), head + 1, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+void*
+consumer(void* arg)
+{
+    ring* rr = (ring*) arg;
+    for (long ii = 0; ii < ops_per_pair; ++ii) {
+        long tail = rr->tail;
+        while (__atomic_load_n(&(rr->head), __ATOMIC_ACQUIRE) == tail) {
+            sched_yield();
+        }
+        long* item = rr->slots[tail % RING_SIZE];
+        assert(item[0] == ii);
+        xfree(item);
+        __atomic_store_n(&(rr->tail), tail + 1, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    pthread_t threads[2 * MAX_PAIRS];
+    int pairs = 2;
+    int rv;
+
+    if (argc > 3) {
+        printf("Usage:\n");
+        printf("\t%s [PAIRS] [OPS_PER_PAIR]\n", argv[0]);
+        return 1;
+    }
+    if (argc >= 2) {
+        pairs = atoi(argv[1]);
+        assert(pairs > 0 && pairs <= MAX_PAIRS);
+    }
+    if (argc == 3) {
+        ops_per_pair = atol(argv[2]);
+    }
+
+    double t0 = now_s();
+    for (int ii = 0; ii < pairs; ++ii) {
+        rv = pthread_create(&(threads[2 * ii]), 0, producer, &(rings[ii]));
+        assert(rv == 0);
+        rv = pthread_create(&(threads[2 * ii + 1]), 0, consumer, &(rings[ii]));
+        assert(rv == 0);
+    }
+    for (int ii = 0; ii < 2 * pairs; ++ii) {
+        rv = pthread_join(threads[ii], 0);
+        assert(rv == 0);
+    }
+    double t1 = now_s();
+
+    double ops = (double) pairs * ops_per_pair / (t1 - t0);
+    printf("pairs,ops_per_sec,ops_per_sec_per_thread\n");
+    printf("%d,%.0f,%.0f\n", pairs, ops, ops / (2 * pairs));
+    return 0;
+}
@@ -0,0 +1,116 @@
+// opt_memalign check.
+//
+// For every power-of-two alignment from 1 byte to 1 MB, well past the
+// page size, allocates small, medium and large blocks with opt_memalign.
+// Checks the alignment, fills all of opt_usable_size, and then checks
+// that opt_realloc keeps the contents when a block grows, shrinks or
+// keeps its size, and that opt_free takes back both the ALIGNED-tagged
+// pointers and what opt_realloc made of them. Also checks that
+// alignments that are not powers of two are refused.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "optmalloc.h"
+
+#define MAX_ALIGN (1UL << 20)
+
+static const size_t sizes[] = {
+    // small
+    1, 16, 100, 1024,
+    // medium
+    1025, 2000, 4000,
+    // large
+    5000, 70000, 300000,
+};
+
+static
+void
+check(int ok, const char* what, size_t align, size_t size)
+{
+    if (!ok) {
+        fprintf(stderr, "check-memalign: %s (align %zu, size %zu)\n", what, align, size);
+        exit(1);
+    }
+}
+
+static
+void
+check_fill(unsigned char* ptr, size_t count, unsigned char byte, size_t align, size_t size)
+{
+    for (size_t ii = 0; ii < count; ++ii) {
+        check(ptr[ii] == byte, "contents lost", align, size);
+    }
+}
+
+static
+unsigned char*
+aligned_block(size_t align, size_t size, unsigned char byte)
+{
+    unsigned char* ptr = opt_memalign(align, size);
+    check(ptr != 0, "allocation failed", align, size);
+    check(((uintptr_t) ptr) % align == 0, "misaligned", align, size);
+    size_t usable = opt_usable_size(ptr);
+    check(usable >= size, "usable size too small", align, size);
+    memset(ptr, byte, usable);
+    return ptr;
+}
+
+static
+void
+check_align(size_t align, size_t size)
+{
+    // freed as it came.
+    unsigned char* xs = aligned_block(align, size, 0x11);
+    opt_free(xs);
+
+    // resized to the same size, then grown.
+    unsigned char* ys = aligned_block(align, size, 0x22);
+    ys = opt_realloc(ys, size);
+    check(ys != 0, "realloc to the same size failed", align, size);
+    check_fill(ys, size, 0x22, align, size);
+    ys = opt_realloc(ys, 3 * size + 7);
+    check(ys != 0, "growing realloc failed", align, size);
+    check(opt_usable_size(ys) >= 3 * size + 7, "usable size too small after growing",
+          align, size);
+    check_fill(ys, size, 0x22, align, size);
+    opt_free(ys);
+
+    // shrunk.
+    unsigned char* zs = aligned_block(align, size, 0x33);
+    size_t half = size / 2 + 1;
+    zs = opt_realloc(zs, half);
+    check(zs != 0, "shrinking realloc failed", align, size);
+    check(opt_usable_size(zs) >= half, "usable size too small after shrinking", align, size);
+    check_fill(zs, half, 0x33, align, size);
+    opt_free(zs);
+}
+
+int
+main(int argc, char* argv[])
+{
+    for (size_t align = 1; align <= MAX_ALIGN; align *= 2) {
+        for (int ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+            check_align(align, sizes[ii]);
+        }
+    }
+
+    // several live at once, so neighbouring blocks would catch overruns.
+    unsigned char* live[sizeof(sizes) / sizeof(sizes[0])];
+    for (int ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+        live[ii] = aligned_block(4096, sizes[ii], (unsigned char) ii);
+    }
+    for (int ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+        check_fill(live[ii], sizes[ii], (unsigned char) ii, 4096, sizes[ii]);
+        opt_free(live[ii]);
+    }
+
+    check(opt_memalign(0, 100) == 0, "alignment 0 was taken", 0, 100);
+    check(opt_memalign(24, 100) == 0, "alignment 24 was taken", 24, 100);
+    check(opt_aligned_alloc(48, 100) == 0, "alignment 48 was taken", 48, 100);
+
+    printf("memalign ok\n");
+    return 0;
+}
@@ -0,0 +1,108 @@
+
+// Aligned allocation check for liboptmalloc.so.
+//
+// Run under LD_PRELOAD. For every power-of-two alignment from 1 byte to
+// 1 MB and a spread of sizes from 0 up to a large chunk, allocates with
+// posix_memalign, memalign and aligned_alloc and checks the alignment
+// and the usable size, that realloc keeps the contents, and that free
+// takes the pointer back. Also checks the libc error conventions the
+// preload library follows. Fails if liboptmalloc.so is not loaded.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#define MAX_ALIGN (1UL << 20)
+
+static const size_t sizes[] = {
+    0, 1, 15, 16, 17, 64, 100, 1000, 1024, 1025, 3000, 4096, 10000, 70000, 300000,
+};
+
+static
+int
+preloaded()
+{
+    FILE* fh = fopen("/proc/self/maps", "r");
+    if (fh == 0) {
+        return 0;
+    }
+    char line[512];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), fh)) {
+        found = strstr(line, "liboptmalloc.so") != 0;
+    }
+    fclose(fh);
+    return found;
+}
+
+static
+void
+check(int ok, const char* what, size_t align, size_t size)
+{
+    if (!ok) {
+        fprintf(stderr, "check-preload-align: %s (align %zu, size %zu)\n", what, align, size);
+        exit(1);
+    }
+}
+
+static
+void
+check_block(void* ptr, size_t align, size_t size)
+{
+    check(ptr != 0, "allocation failed", align, size);
+    check(((uintptr_t) ptr) % align == 0, "misaligned", align, size);
+    check(malloc_usable_size(ptr) >= size, "usable size too small", align, size);
+    memset(ptr, 0xab, size);
+
+    unsigned char* grown = realloc(ptr, 2 * size + 5);
+    check(grown != 0, "realloc failed", align, size);
+    for (size_t ii = 0; ii < size; ii += 7) {
+        check(grown[ii] == 0xab, "realloc lost contents", align, size);
+    }
+    free(grown);
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (!preloaded()) {
+        fprintf(stderr, "check-preload-align: run with LD_PRELOAD=liboptmalloc.so\n");
+        return 1;
+    }
+
+    for (size_t align = 1; align <= MAX_ALIGN; align *= 2) {
+        for (int ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+            size_t size = sizes[ii];
+            void* ptr = 0;
+            if (align >= sizeof(void*)) {
+                check(posix_memalign(&ptr, align, size) == 0, "posix_memalign failed",
+                      align, size);
+                check_block(ptr, align, size);
+            }
+            check_block(memalign(align, size), align, size);
+            check_block(aligned_alloc(align, size + 1), align, size + 1);
+        }
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    check_block(valloc(100), page, 100);
+    check_block(pvalloc(100), page, page);
+
+    // volatile, so the compiler doesn't reject the sizes outright.
+    volatile size_t huge = SIZE_MAX;
+    void* ptr = 0;
+    check(posix_memalign(&ptr, 24, 100) == EINVAL, "posix_memalign took a bad alignment",
+          24, 100);
+    errno = 0;
+    check(malloc(huge) == 0 && errno == ENOMEM, "malloc(SIZE_MAX) did not fail", 1, huge);
+    check(calloc(huge / 2, 4) == 0, "calloc overflow was not caught", 1, huge);
+    free(0);
+
+    printf("preload align ok\n");
+    return 0;
+}
@@ -0,0 +1,75 @@
+
+// Fork check for liboptmalloc.so.
+//
+// Run under LD_PRELOAD. Keeps THREADS threads allocating and freeing
+// while the main thread forks FORKS children, each of which allocates
+// small, medium and large blocks and frees them again. A fork taken
+// while another thread held an allocator lock would leave the child
+// stuck on it, so every child must exit cleanly, within the timeout
+// that make test runs this under.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define THREADS 3
+#define FORKS   200
+
+static volatile int done = 0;
+
+static
+void*
+churn(void* arg)
+{
+    for (long ii = 0; !done; ++ii) {
+        void* ptr = malloc(ii % 3000 + 1);
+        free(ptr);
+        if (ii % 1000 == 0) {
+            free(malloc(200000));
+        }
+    }
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    pthread_t threads[THREADS];
+    for (int ii = 0; ii < THREADS; ++ii) {
+        if (pthread_create(&(threads[ii]), 0, churn, 0) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    for (int ii = 0; ii < FORKS; ++ii) {
+        pid_t child = fork();
+        if (child == 0) {
+            char* small = malloc(20);
+            char* medium = malloc(2000);
+            char* large = malloc(100000);
+            memset(large, 1, 100000);
+            free(small);
+            free(medium);
+            free(large);
+            _exit(0);
+        }
+        int status;
+        if (child < 0 || waitpid(child, &status, 0) != child
+                || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "check-preload-fork: child %d failed\n", ii);
+            return 1;
+        }
+    }
+
+    done = 1;
+    for (int ii = 0; ii < THREADS; ++ii) {
+        pthread_join(threads[ii], 0);
+    }
+
+    printf("preload fork ok\n");
+    return 0;
+}
@@ -0,0 +1,40 @@
+
+// Span cache decay regression check.
+//
+// Frees a large chunk into the span cache, waits until the cached span
+// is past its decay time, then allocates the same size again. That
+// allocation both finds the stale span in its bucket and trims it from
+// the cache, and used to reuse the span after unmapping it. Runs with a
+// short decay unless OPTMALLOC_SPAN_DECAY_MS is already set.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "optmalloc.h"
+
+#define ROUNDS 5
+#define SIZE   100000
+
+int
+main(int argc, char* argv[])
+{
+    setenv("OPTMALLOC_SPAN_DECAY_MS", "5", 0);
+    long decay_ms = atol(getenv("OPTMALLOC_SPAN_DECAY_MS"));
+
+    for (int ii = 0; ii < ROUNDS; ++ii) {
+        char* xs = opt_malloc(SIZE);
+        memset(xs, ii, SIZE);
+        opt_free(xs);
+
+        usleep((decay_ms + 20) * 1000);
+
+        char* ys = opt_malloc(SIZE);
+        memset(ys, ii, SIZE);
+        opt_free(ys);
+    }
+
+    printf("span decay ok\n");
+    return 0;
+}
@@ -23,9 +23,31 @@ xfree(void* ptr)
     hfree(ptr);
 }
 
+void
+xfree_sized(void* ptr, size_t bytes)
+{
+    hfree(ptr);
+}
+
 void*
 xrealloc(void* prev, size_t bytes)
 {
     return hrealloc(prev, bytes);
 }
 
+size_t
+xmalloc_batch(size_t bytes, size_t nn, void** out)
+{
+    for (size_t ii = 0; ii < nn; ++ii) {
+        out[ii] = hmalloc(bytes);
+    }
+    return nn;
+}
+
+void
+xfree_batch(void** ptrs, size_t nn)
+{
+    for (size_t ii = 0; ii < nn; ++ii) {
+        hfree(ptrs[ii]);
+    }
+}
@@ -1,8 +1,13 @@
 #ifndef LIST_H
 #define LIST_H
 
+#include <assert.h>
+
 #include "xmalloc.h"
 
+// copy_list and free_list allocate and free cells this many at a time.
+#define LIST_BATCH 64
+
 // Linked list cell.
 typedef struct cell {
     long         item;
@@ -35,10 +40,14 @@ static
 void
 free_list(cell* xs)
 {
+    void* cells[LIST_BATCH];
     while (xs) {
-        cell* ys = xs->rest;
-        xfree(xs);
-        xs = ys;
+        long nn = 0;
+        while (xs && nn < LIST_BATCH) {
+            cells[nn++] = xs;
+            xs = xs->rest;
+        }
+        xfree_batch(cells, nn);
     }
 }
 
@@ -46,12 +55,29 @@ static
 cell*
 copy_list(cell* xs)
 {
-    if (xs == 0) {
-        return 0;
-    }
+    cell* cells[LIST_BATCH];
+    cell* ys = 0;
+    cell** tail = &ys;
+    while (xs) {
+        long nn = 0;
+        for (cell* zs = xs; zs && nn < LIST_BATCH; zs = zs->rest) {
+            nn++;
+        }
+        // a short batch is topped up one cell at a time, like cons.
+        long got = xmalloc_batch(sizeof(cell), nn, (void**) cells);
+        for (long ii = got; ii < nn; ++ii) {
+            cells[ii] = xmalloc(sizeof(cell));
+        }
 
-    cell* ys = copy_list(xs->rest);
-    return cons(xs->item, ys);
+        for (long ii = 0; ii < nn; ++ii) {
+            cells[ii]->item = xs->item;
+            *tail = cells[ii];
+            tail = &(cells[ii]->rest);
+            xs = xs->rest;
+        }
+    }
+    *tail = 0;
+    return ys;
 }
 
 #endif
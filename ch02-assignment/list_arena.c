@@ -0,0 +1,203 @@
+
+// The Collatz conjecture:
+//
+// If we start with some number n and iterate the following:
+// - If x is even, n -> n/2
+// - If x is odd,  n -> 3*n + 1
+// We'll eventually get to 1.
+
+// This program searches for the largest number of steps that
+// this takes for numbers from 2 to a provided TOP number.
+
+// To calculate this:
+//  - calculate the entire sequence for each starting value
+//    using multiple threads.
+//  - calculate the length of the sequence 
+// Next
+
+// This is the arena version of list_main.c: each task keeps its list in
+// one of two arenas of its own. A step resets the other arena, copies
+// the list into it, conses the step's new cells there too, and switches
+// to it, so the old copy is dropped with the reset instead of freed.
+
+#include <stdio.h>
+#include <pthread.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "xmalloc.h"
+#include "xarena.h"
+#include "list.h"
+
+#define THREADS 4
+
+typedef struct num_task {
+    cell*   vals;
+    long    steps;
+    int     dibs;
+    xarena* arenas[2];
+    int     cur;
+    pthread_mutex_t lock;
+} num_task;
+
+num_task** tasks;
+long data_top = 0;
+
+long
+collatz_step(long n)
+{
+    if (n % 2 == 0) {
+        return n/2;
+    }
+    else {
+        return 3*n + 1;
+    }
+}
+
+cell*
+arena_cons(xarena* arena, long item, cell* rest)
+{
+    cell* xs = xarena_alloc(arena, sizeof(cell));
+    xs->item = item;
+    xs->rest = rest;
+    return xs;
+}
+
+cell*
+arena_copy_list(xarena* arena, cell* xs)
+{
+    cell* ys = 0;
+    cell** tail = &ys;
+    for (; xs; xs = xs->rest) {
+        *tail = arena_cons(arena, xs->item, 0);
+        tail = &((*tail)->rest);
+    }
+    return ys;
+}
+
+cell*
+iterate(xarena* arena, cell* xs)
+{
+    long vv = 0;
+    for (int jj = 0; vv != 1 && jj < 50; ++jj) {
+        vv = collatz_step(xs->item);
+        xs = arena_cons(arena, vv, xs);
+    }
+    return xs;
+}
+
+int
+scan_and_iterate()
+{
+    long done_count = 0;
+    long base = random() % data_top;
+
+    for (long i0 = 1; i0 < data_top; ++i0) {
+        long ii = 1 + (base + i0) % (data_top - 1);
+
+        pthread_mutex_lock(&(tasks[ii]->lock));
+        int skip = tasks[ii]->dibs;
+        if (!skip) {
+            tasks[ii]->dibs = 1;
+        }
+        pthread_mutex_unlock(&(tasks[ii]->lock));
+        if (skip) {
+            continue;
+        }
+
+        cell* xs = tasks[ii]->vals;
+        long vv = xs->item;
+
+        if (vv > 1) {
+            int next = !tasks[ii]->cur;
+            xarena_reset(tasks[ii]->arenas[next]);
+            xs = arena_copy_list(tasks[ii]->arenas[next], xs);
+            xs = iterate(tasks[ii]->arenas[next], xs);
+            tasks[ii]->vals = xs;
+            tasks[ii]->cur  = next;
+        }
+        else {
+            if (tasks[ii]->steps == -1) {
+                tasks[ii]->steps = count_list(tasks[ii]->vals) - 1;
+            }
+
+            done_count += 1;
+        }
+
+        pthread_mutex_lock(&(tasks[ii]->lock));
+        tasks[ii]->dibs = 0;
+        pthread_mutex_unlock(&(tasks[ii]->lock));
+    }
+
+    return done_count == (data_top - 1);
+}
+
+void*
+worker(void* _arg)
+{
+    int done = 0;
+    while (!done) {
+        done = scan_and_iterate();
+    }
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    pthread_t threads[THREADS];
+    int rv;
+
+    if (argc != 2) {
+        printf("Usage:\n");
+        printf("\t%s TOP\n", argv[0]);
+        return 1;
+    }
+
+    data_top  = atol(argv[1]);
+
+    tasks = xmalloc(data_top * sizeof(num_task*));
+    for (int ii = 0; ii < data_top; ++ii) {
+        tasks[ii] = xmalloc(sizeof(num_task));
+        tasks[ii]->arenas[0] = xarena_create();
+        tasks[ii]->arenas[1] = xarena_create();
+        tasks[ii]->cur = 0;
+        tasks[ii]->vals  = arena_cons(tasks[ii]->arenas[0], ii, 0);
+        tasks[ii]->steps = -1;
+        tasks[ii]->dibs  = 0;
+        pthread_mutex_init(&(tasks[ii]->lock), 0);
+    }
+
+    for (int ii = 0; ii < THREADS; ++ii) {
+        rv = pthread_create(&(threads[ii]), 0, worker, 0);
+        assert(rv == 0);
+    }
+
+    for (int ii = 0; ii < THREADS; ++ii) {
+        rv = pthread_join(threads[ii], 0);
+        assert(rv == 0);
+    }
+
+    long max_v = 0;
+    long max_s = 0;
+
+    for (int ii = 0; ii < data_top; ++ii) {
+        if (tasks[ii]->steps > max_s) {
+            max_v = ii;
+            max_s = tasks[ii]->steps;
+        }
+    }
+
+    printf("Max steps is at %ld: %ld steps\n", max_v, max_s);
+
+    for (int ii = 0; ii < data_top; ++ii) {
+        xarena_destroy(tasks[ii]->arenas[0]);
+        xarena_destroy(tasks[ii]->arenas[1]);
+        xfree(tasks[ii]);
+    }
+    xfree(tasks);
+
+    return 0;
+}
+
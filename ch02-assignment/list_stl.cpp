@@ -0,0 +1,154 @@
+// The Collatz conjecture, as in list_main.c, ported to C++: each task's
+// sequence is a std::list, copied and extended a step at a time.
+//
+// Built plain, the list uses std::allocator and the default operator
+// new. Built with OPT_ALLOCATOR, the list uses optmalloc::allocator and
+// the program is linked with optmalloc's operator new and delete.
+
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef OPT_ALLOCATOR
+#include "optmalloc.hpp"
+template <class T> using alloc = optmalloc::allocator<T>;
+#else
+template <class T> using alloc = std::allocator<T>;
+#endif
+
+#define THREADS 4
+
+typedef std::list<long, alloc<long>> num_seq;
+
+struct num_task {
+    num_seq*  vals;
+    long       steps;
+    int        dibs;
+    std::mutex lock;
+};
+
+std::vector<num_task*> tasks;
+long data_top = 0;
+
+long
+collatz_step(long n)
+{
+    if (n % 2 == 0) {
+        return n/2;
+    }
+    else {
+        return 3*n + 1;
+    }
+}
+
+void
+iterate(num_seq* xs)
+{
+    long vv = 0;
+    for (int jj = 0; vv != 1 && jj < 50; ++jj) {
+        vv = collatz_step(xs->front());
+        xs->push_front(vv);
+    }
+}
+
+int
+scan_and_iterate()
+{
+    long done_count = 0;
+    long base = random() % data_top;
+
+    for (long i0 = 1; i0 < data_top; ++i0) {
+        long ii = 1 + (base + i0) % (data_top - 1);
+
+        int skip;
+        {
+            std::lock_guard<std::mutex> guard(tasks[ii]->lock);
+            skip = tasks[ii]->dibs;
+            tasks[ii]->dibs = 1;
+        }
+        if (skip) {
+            continue;
+        }
+
+        num_seq* xs = tasks[ii]->vals;
+        long vv = xs->front();
+
+        if (vv > 1) {
+            xs = new num_seq(*xs);
+            iterate(xs);
+            delete tasks[ii]->vals;
+            tasks[ii]->vals = xs;
+        }
+        else {
+            if (tasks[ii]->steps == -1) {
+                tasks[ii]->steps = tasks[ii]->vals->size() - 1;
+            }
+
+            done_count += 1;
+        }
+
+        std::lock_guard<std::mutex> guard(tasks[ii]->lock);
+        tasks[ii]->dibs = 0;
+    }
+
+    return done_count == (data_top - 1);
+}
+
+void
+worker()
+{
+    int done = 0;
+    while (!done) {
+        done = scan_and_iterate();
+    }
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        printf("Usage:\n");
+        printf("\t%s TOP\n", argv[0]);
+        return 1;
+    }
+
+    data_top = atol(argv[1]);
+
+    tasks.resize(data_top);
+    for (long ii = 0; ii < data_top; ++ii) {
+        tasks[ii] = new num_task;
+        tasks[ii]->vals  = new num_seq(1, ii);
+        tasks[ii]->steps = -1;
+        tasks[ii]->dibs  = 0;
+    }
+
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < THREADS; ++ii) {
+        threads.emplace_back(worker);
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    long max_v = 0;
+    long max_s = 0;
+
+    for (long ii = 0; ii < data_top; ++ii) {
+        if (tasks[ii]->steps > max_s) {
+            max_v = ii;
+            max_s = tasks[ii]->steps;
+        }
+    }
+
+    printf("Max steps is at %ld: %ld steps\n", max_v, max_s);
+
+    for (long ii = 0; ii < data_top; ++ii) {
+        delete tasks[ii]->vals;
+        delete tasks[ii];
+    }
+
+    return 0;
+}
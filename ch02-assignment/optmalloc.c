@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <sys/mman.h>
 #include <stdio.h>
 #include <stddef.h>
@@ -5,6 +6,22 @@
 #include <stdbool.h>
 #include <pthread.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef OPT_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+#ifdef OPT_PERCPU
+#include <sched.h>
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#endif
+#endif
 
 #include "optmalloc.h"
 
@@ -15,6 +32,12 @@
   long chunks_allocated;
   long chunks_freed;
   long free_length;
+  long span_hits;
+  long span_cached_bytes;
+  long scavenged_bytes;
+  long huge_bytes;
+  hm_lock_stats mutex_locks[HM_LOCK_SITES];
+  hm_lock_stats heap_locks[HM_LOCK_SITES];
   } hm_stats;
 */
 
@@ -29,54 +52,486 @@ typedef struct header {
 } header;
 
 
-const size_t PAGE_SIZE = 4096;
+/*
+ * Small requests are rounded up to one of NUM_CLASSES size classes.
+ * Classes are 16 bytes apart up to 128 bytes, then there are four
+ * classes per doubling up to SMALL_MAX, so rounding wastes at most 15
+ * bytes below 128 and under 20% of the object above it.
+ *
+ * Each class has its own free list, refilled by carving a run of
+ * whole pages into slots of that class. A run is the smallest number
+ * of pages (at most MAX_RUN_PAGES) whose leftover tail is no more than
+ * 1/8 of the run; that tail is never used.
+ *
+ * Class objects have no header: the page map below gives the class of
+ * every run page, so opt_free sizes an object from its address alone.
+ * The slots start at the run's first byte, so each object is aligned to
+ * the largest power of two, up to a page, that divides the slot size.
+ */
+#define NUM_CLASSES   20
+#define SMALL_MAX     1024
+#define MAX_RUN_PAGES 8
+
+static const size_t class_sizes[NUM_CLASSES] = {
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256,
+	320, 384, 448, 512,
+	640, 768, 896, 1024,
+};
+
+/*
+ * The first SLAB_CLASSES classes (requests up to SLAB_MAX bytes) are
+ * served from slab pages instead: each page holds slots of one size with
+ * no per-object header, and a bitmap in the page header marks the free
+ * slots. Slab pages live in superblocks of their own, so a pointer is
+ * known to be a slab object by its address alone.
+ */
+#define SLAB_CLASSES   4
+#define SLAB_MAX       64
+#define SLAB_HEADER    64
+#define SLAB_MAP_WORDS 4
+
+/*
+ * All small and medium memory lives in one region that is reserved
+ * inaccessible up front and committed one SUPERBLOCK_SIZE superblock at
+ * a time. The region is HEAP_REGION_SIZE bytes if the address space
+ * allows, or the largest power-of-two fraction of that, down to
+ * HEAP_REGION_MIN, that can be reserved along with its page metadata. Slab and class-run superblocks are taken from
+ * the bottom of the region upwards; medium superblocks are taken from
+ * the top downwards, so the medium heap stays contiguous and free chunks
+ * merge across superblock boundaries. sb_kind records what each
+ * superblock holds.
+ *
+ * The page map is a two-level radix tree over the region: sb_kind's
+ * index picks a class-run superblock's leaf, which holds a byte per page
+ * giving the size class of the run the page belongs to. Leaves are
+ * carved when their superblock is taken and never freed. Slab pages keep
+ * their class and owning heap in their own header instead.
+ */
+#define HEAP_REGION_SIZE (64UL << 30)
+#define HEAP_REGION_MIN  (64UL << 20)
+#define SUPERBLOCK_SIZE  (1UL << 20)
+#define SUPERBLOCKS      (HEAP_REGION_SIZE / SUPERBLOCK_SIZE)
+
+#define SB_UNUSED 0
+#define SB_SLAB   1
+#define SB_RUN    2
+#define SB_MEDIUM 3
+
+#define SB_PAGES (SUPERBLOCK_SIZE / PAGE_SIZE)
+
+// Hands out whole pages from the current superblock of one kind.
+typedef struct page_source {
+	void* next;
+	void* end;
+	int kind;
+} page_source;
+
+typedef struct slab_page {
+	uint64_t free_map[SLAB_MAP_WORDS];
+	struct slab_page* next;
+	struct slab_page* prev;
+	struct tcache* owner;
+	int cls;
+	int free_count;
+} slab_page;
+
+/*
+ * Free small objects are kept in bins as user pointers, each linked
+ * through its first word.
+ */
+typedef opt_bin class_bin;
+
+/*
+ * Per-thread heap: a cache of free small chunks, one bin per size class.
+ * Small allocations and frees are served from here without taking
+ * the global mutex; the shared class bins are only touched in batches
+ * when a bin runs empty or grows past TCACHE_LIMIT.
+ *
+ * A heap also owns the slab pages it carved, and only it hands out their
+ * slots. A slab object freed by another thread is pushed onto its owning
+ * heap's remote list with a compare-and-swap; the owner takes the whole
+ * list with one exchange when it next refills a slab bin. Heaps outlive
+ * their threads: an exited thread's heap is adopted by the next new
+ * thread, along with its pages and any frees still arriving for them.
+ *
+ * The bins and the allocation counters come first, as the opt_heap that
+ * optmalloc.h's inline fast path works on directly.
+ */
+#define TCACHE_BATCH 32
+#define TCACHE_LIMIT 64
+
+typedef struct tcache {
+	opt_heap fast;
+	slab_page* partial[SLAB_CLASSES];
+	void* remote;
+	int lock;
+	hm_lock_stats locks[HM_LOCK_SITES];
+	struct tcache* next_heap;
+	struct tcache* next_free;
+} __attribute__((aligned(64))) tcache;
+
+// optmalloc.h inlines the cache fast path against these.
+_Static_assert(NUM_CLASSES == OPT_CLASSES, "OPT_CLASSES");
+_Static_assert(SLAB_MAX == OPT_SLAB_MAX, "OPT_SLAB_MAX");
+_Static_assert(SMALL_MAX == OPT_SMALL_MAX, "OPT_SMALL_MAX");
+_Static_assert(TCACHE_LIMIT == OPT_CACHE_LIMIT, "OPT_CACHE_LIMIT");
+_Static_assert(offsetof(slab_page, owner) == OPT_SLAB_OWNER, "OPT_SLAB_OWNER");
+
+/*
+ * With OPT_PERCPU defined, heaps belong to CPUs instead of threads. The
+ * fast path picks the heap of the CPU it is running on and holds that
+ * heap's spin lock while it works, so cache memory is bounded by the
+ * core count however many threads there are. The CPU number is read from
+ * the rseq area glibc registers for each thread, falling back to
+ * sched_getcpu. A thread migrated in mid-call just finishes on the old
+ * CPU's heap; its lock keeps that safe.
+ */
+#define MAX_CPUS 256
+
+/*
+ * With OPT_PROFILE defined, each call to opt_malloc, opt_free and
+ * opt_realloc is timed with the cycle counter and recorded in the calling
+ * thread's prof_block: a power-of-two histogram of request sizes, and for
+ * each entry point a histogram of latencies with PROF_SUB buckets per
+ * doubling. hgetprofile merges the blocks and reads percentiles off the
+ * merged histograms. A block outlives its thread and is reused by the
+ * next new one, so no counts are lost.
+ */
+#define PROF_SUB_BITS 2
+#define PROF_SUB      (1 << PROF_SUB_BITS)
+#define PROF_BUCKETS  ((65 - PROF_SUB_BITS) * PROF_SUB)
+
+#define PROF_MALLOC  0
+#define PROF_FREE    1
+#define PROF_REALLOC 2
+#define PROF_OPS     3
+
+typedef struct prof_block {
+	long sizes[HM_SIZE_BUCKETS];
+	long cycles[PROF_OPS][PROF_BUCKETS];
+	struct prof_block* next_block;
+	struct prof_block* next_free;
+} __attribute__((aligned(64))) prof_block;
+
+/*
+ * Medium chunks (above SMALL_MAX, up to MEDIUM_MAX) carry boundary tags:
+ * the size word is repeated in a footer at the end of the chunk, with
+ * IN_USE set while the chunk is allocated. Large headers never have
+ * IN_USE set, so the bit also tells opt_free a chunk is medium. A freed
+ * chunk reads the footer before it and the header after it to find and
+ * merge free neighbours in constant time. Each medium region is
+ * bracketed by an in-use fence word at either end so merging stops at
+ * its edges.
+ *
+ * Free medium chunks are kept unordered in bins MEDIUM_BIN_WIDTH apart.
+ */
+#define IN_USE           1
+#define MEDIUM_BIN_WIDTH 256
+#define MEDIUM_BINS      17
+#define MEDIUM_MIN       (sizeof(free_cell) + sizeof(size_t))
+
+/*
+ * Every pointer opt_malloc returns is 16-byte aligned. Large chunks keep
+ * their header in the first LARGE_HEADER bytes of their pages, with the
+ * size repeated in the word just before the pointer, where opt_free
+ * looks for it.
+ */
+#define LARGE_HEADER 16
+
+/*
+ * opt_memalign serves any alignment up to SMALL_MAX for small sizes from
+ * a size class whose objects are all aligned that way. Otherwise it carves
+ * an aligned pointer out of a larger ordinary chunk, and when that
+ * pointer is not the chunk's own, the word before it holds the distance
+ * back to the chunk's pointer, tagged with ALIGNED; real headers are
+ * multiples of 16 bytes, possibly with IN_USE, so never have that bit.
+ */
+#define MAX_CLASS_ALIGN SMALL_MAX
+#define ALIGNED         2
+
+/*
+ * Freed large spans are kept mapped in a bounded cache instead of being
+ * unmapped straight away, so the next large allocation of the same page
+ * count can reuse one without a syscall. Spans of fewer than SPAN_BUCKETS
+ * pages are bucketed by exact page count; longer ones share the last
+ * bucket and are reused when no more than 1/8 larger than the request.
+ * Spans are unmapped oldest first while the cache holds more than its
+ * byte limit or once they have sat unused for the decay interval. Both
+ * can be set with OPTMALLOC_SPAN_CACHE_BYTES and OPTMALLOC_SPAN_DECAY_MS.
+ * The scavenger below releases an idle span's pages long before that,
+ * so the decay only bounds how long its mapping is kept.
+ */
+#define SPAN_BUCKETS     128
+#define SPAN_CACHE_BYTES (64UL << 20)
+#define SPAN_DECAY_MS    10000
+
+/*
+ * Free memory that stays unused for the scavenge interval is handed back
+ * to the kernel with MADV_DONTNEED, which keeps it mapped but drops its
+ * pages until they are next touched. The scavenger runs on the slow
+ * paths under the mutex, at most once per interval, and covers:
+ *
+ *  - slab pages left entirely free, which their heap gives up to a
+ *    shared pool; pages pooled for a whole interval are scavenged and
+ *    kept on a stack of clean pages, used before fresh ones.
+ *  - whole pages inside free medium chunks. page_state tracks each
+ *    medium page: writing to a page makes it dirty, a pass finding it
+ *    free makes it idle, and the next pass finding it still idle
+ *    scavenges it.
+ *  - cached large spans idle for an interval, past their first page,
+ *    which is left holding the span.
+ *
+ * The interval can be set with OPTMALLOC_SCAVENGE_MS.
+ */
+#define SCAVENGE_MS    1000
+#define SCAVENGE_TICKS 16
+
+#define PAGE_DIRTY 0
+#define PAGE_IDLE  1
+#define PAGE_CLEAN 2
+
+/*
+ * With OPTMALLOC_HUGEPAGES=1 in the environment, memory is laid out so
+ * the kernel can back it with transparent huge pages. The heap region is
+ * reserved at a HUGE_PAGE_SIZE boundary and committed a huge page, two
+ * superblocks, at a time, and large spans of at least a huge page are
+ * mapped at a huge-page boundary. Both are marked MADV_HUGEPAGE, which
+ * THP needs in its madvise mode. huge_bytes counts the bytes held in
+ * whole, aligned huge pages so marked. Scavenging part of a huge page
+ * splits it back into small pages, so the scavenger takes every huge
+ * page it touches out of huge_bytes: huge_split marks the region's
+ * split huge pages, which are never counted again, and a scavenged
+ * span's huge pages are counted again when it leaves the cache.
+ */
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+/*
+ * Large chunks of at least REMAP_MIN bytes are grown with mremap. Below
+ * that a span cache hit plus memcpy is cheaper than the syscall.
+ */
+#define REMAP_MIN (128UL << 10)
+
+/*
+ * A cached span, stored in the first bytes of the span itself. A span
+ * is zeroed once the scavenger has released everything past its first
+ * page with MADV_DONTNEED, so those pages read as zero and large_alloc
+ * tells opt_calloc not to clear them.
+ */
+typedef struct span {
+	size_t size;
+	struct span* next;
+	struct span* prev;
+	struct span* newer;
+	struct span* older;
+	long freed_ms;
+	bool zeroed;
+} span;
+
+/*
+ * An arena hands out memory by bumping a pointer through a chain of
+ * blocks taken from opt_malloc, each twice the size of the last from
+ * ARENA_MIN_BLOCK up to ARENA_MAX_BLOCK, or just big enough for a larger
+ * request. Nothing in an arena is freed on its own: resetting it rewinds
+ * it to its first block and keeps the chain for reuse, and destroying it
+ * frees the blocks. The arena itself lives at the start of its first
+ * block, ARENA_SELF bytes long.
+ */
+#define ARENA_MIN_BLOCK 256
+#define ARENA_MAX_BLOCK (64UL << 10)
+#define ARENA_ALIGN     16
+
+typedef struct arena_block {
+	struct arena_block* next;
+	size_t size;
+} arena_block;
+
+struct opt_arena {
+	arena_block* first;
+	arena_block* cur;
+	arena_block* last;
+	void* next;
+	void* end;
+};
+
+#define ARENA_SELF ((sizeof(opt_arena) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+const size_t PAGE_SIZE = OPT_PAGE_SIZE;
+const size_t MEDIUM_MAX = 4096 - 2 * sizeof(size_t);
 static hm_stats stats; // This initializes the stats to 0.
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER; 
-static free_cell* free_list_head;
+static free_cell* medium_bins[MEDIUM_BINS];
+static class_bin central[NUM_CLASSES];
+
+static void* heap_base;
+static size_t heap_size;
+static void* heap_low;
+static void* heap_high;
+static void* medium_low;
+static unsigned char sb_kind[SUPERBLOCKS];
+static unsigned char* page_map[SUPERBLOCKS];
+static page_source slab_source = { 0, 0, SB_SLAB };
+static page_source run_source = { 0, 0, SB_RUN };
+
+static span* span_buckets[SPAN_BUCKETS];
+static span* span_newest;
+static span* span_oldest;
+static size_t span_cached_bytes;
+static size_t span_cache_limit = SPAN_CACHE_BYTES;
+static long span_decay_ms = SPAN_DECAY_MS;
+static pthread_once_t tuning_once = PTHREAD_ONCE_INIT;
+static bool hugepages;
+
+static unsigned char* page_state;
+static unsigned char* huge_split;
+static slab_page* empty_slabs;
+static slab_page** clean_slabs;
+static long clean_slab_count;
+static long scavenge_ms = SCAVENGE_MS;
+static long last_scavenge_ms;
+static unsigned int scavenge_tick;
 
+static tcache* all_heaps;
+static void* heap_meta_next;
+static void* heap_meta_end;
+#ifdef OPT_PROFILE
+static __thread prof_block* prof;
+static prof_block* all_blocks;
+static prof_block* idle_blocks;
+static pthread_key_t prof_key;
+static pthread_once_t prof_key_once = PTHREAD_ONCE_INIT;
+#endif
+__thread opt_heap* opt_fast_heap;
+#ifdef OPT_PERCPU
+static tcache* cpu_heaps[MAX_CPUS];
+#else
+static tcache* abandoned_heaps;
+static __thread tcache* cache;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+#endif
+
+
+/**
+ * Adds to a statistics counter. Every counter has one writer at a time
+ * (its heap's owner, or whoever holds the mutex for the shared ones)
+ * and is read without locks, so a relaxed store is enough.
+ */
+static
 void
-check_rv(int rv)
+stat_add(long* counter, long nn)
 {
-	if (rv == -1) {
-		perror("Whoops");
-	}
+	__atomic_store_n(counter, *counter + nn, __ATOMIC_RELAXED);
 }
 
-
+static
 long
-free_list_length_from(free_cell* cell, long acc)
+stat_read(long* counter)
 {
-	if (cell == 0) {
-		return acc;
-	}
-	return free_list_length_from(cell->next, acc + 1);
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
 }
 
-long
-free_list_length()
+/**
+ * Adds a set of lock counters to a snapshot.
+ */
+static
+void
+lock_read(hm_lock_stats* snap, hm_lock_stats* counters)
 {
-	return free_list_length_from(free_list_head, 0);
+    snap->acquired += stat_read(&(counters->acquired));
+    snap->contended += stat_read(&(counters->contended));
+    snap->wait_ns += stat_read(&(counters->wait_ns));
 }
 
+/**
+ * Returns a snapshot of the allocator's statistics, summing the shared
+ * counters with every heap's own counters. Takes no locks, so it can be
+ * polled from a monitoring thread; each thread gets its own snapshot.
+ */
 hm_stats*
 hgetstats()
 {
-    stats.free_length = free_list_length();
-    return &stats;
+    static __thread hm_stats snapshot;
+
+    snapshot.pages_mapped = stat_read(&stats.pages_mapped);
+    snapshot.pages_unmapped = stat_read(&stats.pages_unmapped);
+    snapshot.chunks_allocated = stat_read(&stats.chunks_allocated);
+    snapshot.chunks_freed = stat_read(&stats.chunks_freed);
+    snapshot.free_length = stat_read(&stats.free_length);
+    snapshot.span_hits = stat_read(&stats.span_hits);
+    snapshot.span_cached_bytes = stat_read(&stats.span_cached_bytes);
+    snapshot.scavenged_bytes = stat_read(&stats.scavenged_bytes);
+    snapshot.huge_bytes = stat_read(&stats.huge_bytes);
+
+    memset(snapshot.mutex_locks, 0, sizeof(snapshot.mutex_locks));
+    memset(snapshot.heap_locks, 0, sizeof(snapshot.heap_locks));
+    for (int ii = 0; ii < HM_LOCK_SITES; ++ii) {
+        lock_read(&(snapshot.mutex_locks[ii]), &(stats.mutex_locks[ii]));
+    }
+
+    tcache* heap = __atomic_load_n(&all_heaps, __ATOMIC_ACQUIRE);
+    for (; heap != 0; heap = heap->next_heap) {
+        snapshot.chunks_allocated += stat_read(&(heap->fast.allocs));
+        snapshot.chunks_freed += stat_read(&(heap->fast.frees));
+        for (int ii = 0; ii < HM_LOCK_SITES; ++ii) {
+            lock_read(&(snapshot.heap_locks[ii]), &(heap->locks[ii]));
+        }
+    }
+    return &snapshot;
+}
+
+#ifdef OPT_LOCKSTAT
+static
+void
+print_locks(const char* name, hm_lock_stats* locks)
+{
+    static const char* sites[HM_LOCK_SITES] = {
+        "malloc", "free", "realloc", "refill", "other",
+    };
+    fprintf(stderr, "%s:\n", name);
+    fprintf(stderr, "  %-8s %12s %12s %12s\n", "site", "acquired", "contended", "wait_us");
+    for (int ii = 0; ii < HM_LOCK_SITES; ++ii) {
+        fprintf(stderr, "  %-8s %12ld %12ld %12ld\n", sites[ii], locks[ii].acquired,
+                locks[ii].contended, locks[ii].wait_ns / 1000);
+    }
 }
+#endif
 
 void
 hprintstats()
 {
-    stats.free_length = free_list_length();
+    hm_stats* st = hgetstats();
     fprintf(stderr, "\n== husky malloc stats ==\n");
-    fprintf(stderr, "Mapped:   %ld\n", stats.pages_mapped);
-    fprintf(stderr, "Unmapped: %ld\n", stats.pages_unmapped);
-    fprintf(stderr, "Allocs:   %ld\n", stats.chunks_allocated);
-    fprintf(stderr, "Frees:    %ld\n", stats.chunks_freed);
-    fprintf(stderr, "Freelen:  %ld\n", stats.free_length);
+    fprintf(stderr, "Mapped:   %ld\n", st->pages_mapped);
+    fprintf(stderr, "Unmapped: %ld\n", st->pages_unmapped);
+    fprintf(stderr, "Allocs:   %ld\n", st->chunks_allocated);
+    fprintf(stderr, "Frees:    %ld\n", st->chunks_freed);
+    fprintf(stderr, "Freelen:  %ld\n", st->free_length);
+    fprintf(stderr, "Span hits: %ld\n", st->span_hits);
+    fprintf(stderr, "Span cached: %ld\n", st->span_cached_bytes);
+    fprintf(stderr, "Scavenged: %ld\n", st->scavenged_bytes);
+    fprintf(stderr, "Huge:     %ld\n", st->huge_bytes);
+#ifdef OPT_LOCKSTAT
+    print_locks("Mutex", st->mutex_locks);
+#ifdef OPT_PERCPU
+    print_locks("Heap locks", st->heap_locks);
+#endif
+#endif
+}
+
+#ifdef OPT_LOCKSTAT
+/**
+ * Lock profiling builds print their statistics when the program exits.
+ */
+__attribute__((destructor))
+static
+void
+lock_report()
+{
+    hprintstats();
 }
+#endif
 
 static
 size_t
@@ -94,26 +549,62 @@ div_up(size_t xx, size_t yy)
     }
 }
 
-free_cell*
-add_memory()
+/**
+ * Returns how many bytes of the given range lie in whole, aligned huge
+ * pages.
+ */
+static
+size_t
+huge_bytes_in(void* start, size_t size)
 {
-	stats.pages_mapped += 1;
-	free_cell* cell = (free_cell*) mmap(0, 
-					PAGE_SIZE,
-					PROT_READ|PROT_WRITE,
-					MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-	cell->size = PAGE_SIZE;
-	cell->next = 0;
-	cell->prev = 0;
-	return cell;
+	uintptr_t lo = (((uintptr_t) start) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	uintptr_t hi = (((uintptr_t) start) + size) & ~(HUGE_PAGE_SIZE - 1);
+	return hi > lo ? hi - lo : 0;
+}
+
+/**
+ * Maps bytes of anonymous memory at a huge-page boundary, by mapping
+ * nearly a huge page more than needed and unmapping the ends, and marks
+ * it MADV_HUGEPAGE.
+ */
+static
+void*
+map_huge_aligned(size_t bytes, int prot, int flags)
+{
+	size_t slack = HUGE_PAGE_SIZE - PAGE_SIZE;
+	void* ptr = mmap(0, bytes + slack, prot, MAP_PRIVATE|MAP_ANONYMOUS|flags, -1, 0);
+	if (ptr == MAP_FAILED) {
+		return ptr;
+	}
+
+	void* aligned = (void*) ((((uintptr_t) ptr) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+	size_t head = aligned - ptr;
+	if (head > 0) {
+		munmap(ptr, head);
+	}
+	if (slack > head) {
+		munmap(aligned + bytes, slack - head);
+	}
+	// without THP this fails with EINVAL, and the pages just stay small.
+	madvise(aligned, bytes, MADV_HUGEPAGE);
+	return aligned;
 }
 
 void*
 allocate_pages(size_t num_pages)
 {
-	stats.pages_mapped += num_pages;
-	void* ptr = mmap(0, PAGE_SIZE * num_pages, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-	check_rv(*((int *) ptr));
+	size_t bytes = PAGE_SIZE * num_pages;
+	void* ptr = hugepages && bytes >= HUGE_PAGE_SIZE
+		? map_huge_aligned(bytes, PROT_READ|PROT_WRITE, 0)
+		: mmap(0, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	// running out of memory is the caller's to report; errno says why.
+	if (ptr == MAP_FAILED) {
+		return 0;
+	}
+	stat_add(&stats.pages_mapped, num_pages);
+	if (hugepages) {
+		stat_add(&stats.huge_bytes, huge_bytes_in(ptr, bytes));
+	}
 	return ptr;
 }
 
@@ -124,280 +615,2243 @@ allocate_pages(size_t num_pages)
 void
 deallocate_pages(header* h)
 {
-	assert(h->size > PAGE_SIZE);
-	stats.pages_unmapped += div_up(h->size, PAGE_SIZE);
-	int rv = munmap(h, h->size);
-	check_rv(rv);
+	assert(h->size >= PAGE_SIZE);
+	stat_add(&stats.pages_unmapped, div_up(h->size, PAGE_SIZE));
+	if (hugepages) {
+		stat_add(&stats.huge_bytes, -huge_bytes_in(h, h->size));
+	}
+	munmap(h, h->size);
+}
+
+static
+long
+now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#ifdef OPT_LOCKSTAT
+
+/*
+ * With OPT_LOCKSTAT defined, every acquisition of the global mutex and
+ * of the CPU heap locks is counted against its call site: malloc, free,
+ * realloc, refilling a cache bin, or other bookkeeping. An acquisition
+ * that finds the lock held is contended, and the time spent waiting
+ * for it is added up. Mutex counters live in stats and heap lock
+ * counters in their heap, both written only by the lock holder, so
+ * hgetstats reads them without taking any lock. The program prints its
+ * statistics when it exits.
+ */
+
+static
+long
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
 }
 
 /**
- * Inserts the cell to add into the free list before the current cell.
+ * Counts one acquisition of a lock in the given counters, and if start
+ * is not zero, that the caller had to wait for it from then until now.
+ * Called with the lock held, so each counter has one writer at a time.
  */
+static
 void
-insert_before(free_cell* current, free_cell* to_add)
+lock_record(hm_lock_stats* counters, long start)
 {
-	assert(current != 0 && to_add != 0);
-	if (current->prev == 0) {
-		// current cell is the free_list_head.
-		free_list_head = to_add;
-		to_add->next = current;
-		to_add->prev = 0;
-		current->prev = to_add;
-		return;
+	stat_add(&(counters->acquired), 1);
+	if (start != 0) {
+		stat_add(&(counters->contended), 1);
+		stat_add(&(counters->wait_ns), now_ns() - start);
 	}
-	free_cell* prior_cell = current->prev;
-	prior_cell->next = to_add;
-	to_add->prev = prior_cell;
-	
-	current->prev = to_add;
-	to_add->next = current;
 }
 
+#endif
+
 /**
- *  Inserts the cell to add into the free list after the current cell.
+ * Takes the global mutex on behalf of the given call site. With
+ * OPT_LOCKSTAT, a failed trylock marks the acquisition as contended and
+ * the wait for the blocking lock is timed.
  */
+static
 void
-insert_after(free_cell* current, free_cell* to_add)
+mutex_lock(int site)
 {
-	assert(current != 0 && to_add != 0);
-	if (current->next == 0) {
-		current->next = to_add;
-		to_add->prev = current;
-		to_add->next = 0;
-		return;
+#ifdef OPT_LOCKSTAT
+	long start = 0;
+	if (pthread_mutex_trylock(&mutex) != 0) {
+		start = now_ns();
+		pthread_mutex_lock(&mutex);
 	}
-	free_cell* next_cell = current->next;
-	next_cell->prev = to_add;
-	to_add->next = next_cell;
-
-	current->next = to_add;
-	to_add->prev = current;
+	lock_record(&(stats.mutex_locks[site]), start);
+#else
+	pthread_mutex_lock(&mutex);
+#endif
 }
 
+static
 void
-merge_cells(free_cell* c1, free_cell* c2)
+load_tuning()
 {
-	c1->size = c1->size + c2->size;
-	c1->next = c2->next;
-	if (c1->next != 0) {
-		c1->next->prev = c1;
+	char* bytes = getenv("OPTMALLOC_SPAN_CACHE_BYTES");
+	if (bytes != 0) {
+		span_cache_limit = strtoul(bytes, 0, 10);
+	}
+	char* decay = getenv("OPTMALLOC_SPAN_DECAY_MS");
+	if (decay != 0) {
+		span_decay_ms = strtol(decay, 0, 10);
+	}
+	char* scavenge = getenv("OPTMALLOC_SCAVENGE_MS");
+	if (scavenge != 0) {
+		scavenge_ms = strtol(scavenge, 0, 10);
+	}
+	char* huge = getenv("OPTMALLOC_HUGEPAGES");
+	if (huge != 0) {
+		hugepages = strtol(huge, 0, 10) != 0;
 	}
 }
 
-
-bool
-check_adjacent(free_cell* c1, free_cell* c2)
+static
+int
+span_bucket(size_t size)
 {
-	return (((void*) c1) + c1->size) == c2;
+	size_t pages = size / PAGE_SIZE;
+	return pages < SPAN_BUCKETS ? pages : SPAN_BUCKETS - 1;
 }
 
 /**
- * Coalesces contiguous free cells in the list, checking at the current
- * cell to see if it touches the previous and next chunks.
+ * Unlinks a span from its bucket and from the age list.
+ * Must be called with the mutex held.
  */
 void
-coalesce_at_cell(free_cell* cell)
+span_unlink(span* sp)
 {
-	free_cell* prev = cell->prev;
-	if (prev != 0 && check_adjacent(prev, cell)) {
-		merge_cells(prev, cell);
-		cell = prev;
-	}	
-	free_cell* next = cell->next;
-	if (next != 0 && check_adjacent(cell, next)) {
-		merge_cells(cell, next);
+	if (sp->prev != 0) {
+		sp->prev->next = sp->next;
+	} else {
+		span_buckets[span_bucket(sp->size)] = sp->next;
+	}
+	if (sp->next != 0) {
+		sp->next->prev = sp->prev;
+	}
+
+	if (sp->newer != 0) {
+		sp->newer->older = sp->older;
+	} else {
+		span_newest = sp->older;
+	}
+	if (sp->older != 0) {
+		sp->older->newer = sp->newer;
+	} else {
+		span_oldest = sp->newer;
+	}
+
+	span_cached_bytes -= sp->size;
+	__atomic_store_n(&stats.span_cached_bytes, span_cached_bytes, __ATOMIC_RELAXED);
+
+	// a scavenged span's huge pages fault back in whole once it is reused,
+	// and deallocate_pages takes them out again if it is unmapped.
+	if (sp->zeroed && hugepages) {
+		stat_add(&stats.huge_bytes, huge_bytes_in(sp, sp->size));
 	}
 }
 
 /**
- * Inserts the given chunk of memory into the free list.
- * Maintains sorted order by address.
- * Coalesces contiguous chunks of free memory.
+ * Unmaps the oldest cached spans while the cache is over its byte limit
+ * or they are older than the decay interval.
+ * Must be called with the mutex held.
  */
 void
-insert_chunk_into_list(header* h)
+span_trim(long now)
 {
-	size_t size = h->size;
-	free_cell* cell = (free_cell*) h;
-	cell->size = size;
-	cell->prev = 0;
-	cell->next = 0;
-	if (free_list_head == 0) {
-		free_list_head = cell;
-		// don't have to coalesce here - the free list is empty.
-		return;
-	}
-	
-	free_cell* current = free_list_head;
-	while (current < cell) {
-		if (current->next == 0) {
-			insert_after(current, cell);
-			coalesce_at_cell(cell);
-			return;
-		}
-		current = current->next;
+	while (span_oldest != 0 && (span_cached_bytes > span_cache_limit
+				|| now - span_oldest->freed_ms > span_decay_ms)) {
+		span* sp = span_oldest;
+		span_unlink(sp);
+		deallocate_pages((header*) sp);
 	}
-	insert_before(current, cell);
-	coalesce_at_cell(cell);
-
 }
 
 /**
- * Returns the first cell of the given size,
- * obtaining new memory if necessary.
+ * Returns a cached span of the given page count, or 0 if there is none.
+ * Must be called with the mutex held.
  */
-free_cell*
-first_cell_of_size(size_t size) 
+header*
+span_take(size_t num_pages)
 {
-	assert(size < PAGE_SIZE);
-
-	if (free_list_head == 0) {
-		free_list_head = add_memory();
-		free_list_head->prev = 0;
-		free_list_head->next = 0;
-		return free_list_head;
-	}
+	// trim first: it may unmap the very span the search would pick.
+	span_trim(now_ms());
 
-	free_cell* current = free_list_head;
-	while (current != 0 && current->size < size) {
-		current = current->next;
+	size_t size = num_pages * PAGE_SIZE;
+	span* sp = span_buckets[span_bucket(size)];
+	while (sp != 0 && (sp->size < size || sp->size - size > size / 8)) {
+		sp = sp->next;
 	}
-	if (current == 0) {
-		free_cell* more_mem = add_memory();
-		insert_chunk_into_list((header*)more_mem);
-		return more_mem;
-	} else {
-		return current;
+	if (sp == 0) {
+		return 0;
 	}
+	span_unlink(sp);
+	stat_add(&stats.span_hits, 1);
+	return (header*) sp;
 }
 
+/**
+ * Caches a freed large chunk for reuse, unmapping whatever the cache
+ * can no longer hold. Must be called with the mutex held.
+ */
 void
-split_and_remove_cell(free_cell* cell, size_t size) 
+span_give(header* h)
 {
-	assert(cell != 0);
-	if (cell->size - size > sizeof(free_cell)) {
-		free_cell* split =(free_cell*) (((void*)cell) + size);
-		split->size = cell->size - size;
-		split->next = cell->next;
-		split->prev = cell->prev;
-		if (cell->prev != 0) {
-			cell->prev->next = split;
-		} else {
-			free_list_head = split;
-		}
-		if (cell->next != 0) {
-			cell->next->prev = split;
-		}
+	size_t size = h->size;
+	if (size > span_cache_limit) {
+		deallocate_pages(h);
 		return;
-	} 
+	}
 
-	// Cell was too small to split
-	
+	span* sp = (span*) h;
+	int bucket = span_bucket(size);
+	sp->size = size;
+	sp->zeroed = false;
+	sp->prev = 0;
+	sp->next = span_buckets[bucket];
+	if (sp->next != 0) {
+		sp->next->prev = sp;
+	}
+	span_buckets[bucket] = sp;
 
-	if (cell->prev != 0 && cell->next != 0) { // in middle of list
-		cell->prev->next = cell->next;
-		cell->next->prev = cell->prev;
-	} else if (cell->prev == 0 && cell->next != 0) { // at front of list
-		free_list_head = cell->next;
-		free_list_head->prev = 0;
-	} else if (cell->prev != 0 && cell->next == 0) { // at end of list
-		cell->prev->next = 0;
-	} else { // only item in list
-		free_list_head = 0;
+	long now = now_ms();
+	sp->freed_ms = now;
+	sp->newer = 0;
+	sp->older = span_newest;
+	if (span_newest != 0) {
+		span_newest->newer = sp;
+	} else {
+		span_oldest = sp;
 	}
+	span_newest = sp;
+
+	span_cached_bytes += size;
+	__atomic_store_n(&stats.span_cached_bytes, span_cached_bytes, __ATOMIC_RELAXED);
+	span_trim(now);
 }
 
-free_cell*
-free_cell_at_address(void* addr)
+static
+size_t
+chunk_size(header* h)
 {
-	free_cell* current = free_list_head;
-	while ((void*)current < addr) {
-		if (current == 0) {
-			return 0;
-		}
-		current = current->next;
-	}
-	if (current == addr) {
-		return current;
-	} else {
-		return 0;
-	}
+	return h->size & ~IN_USE;
 }
 
-void*
-opt_malloc(size_t size)
+/**
+ * Marks the medium heap pages overlapping the given range dirty, so the
+ * scavenger leaves them alone until they have been free a while again.
+ */
+static
+void
+pages_touched(void* from, void* to)
 {
-	pthread_mutex_lock(&mutex);
-	stats.chunks_allocated += 1;
-	size += sizeof(size_t);
-	
-	if (size < sizeof(free_cell)) {
-		size = sizeof(free_cell);
+	size_t last = (to - 1 - heap_base) / PAGE_SIZE;
+	for (size_t pg = (from - heap_base) / PAGE_SIZE; pg <= last; ++pg) {
+		page_state[pg] = PAGE_DIRTY;
 	}
+}
 
-	if (size >= PAGE_SIZE) {
-		size_t num_pages = div_up(size, PAGE_SIZE);
-		header* h = (header*) allocate_pages(num_pages);
-		h->size = size;
-		return ((void*) h) + sizeof(size_t);
+/**
+ * Writes a medium chunk's header and footer. An in-use chunk's pages are
+ * all about to be written by its user; a free chunk only has its free
+ * cell and footer written.
+ */
+static
+void
+set_tags(header* h, size_t size, bool in_use)
+{
+	void* footer = ((void*) h) + size - sizeof(size_t);
+	if (in_use) {
+		pages_touched(h, footer + sizeof(size_t));
+	} else {
+		pages_touched(h, ((void*) h) + sizeof(free_cell));
+		pages_touched(footer, footer + sizeof(size_t));
 	}
+	h->size = size | in_use;
+	*((size_t*) footer) = size | in_use;
+}
 
-	// obtain a cell of the necessary size
-	free_cell* cell = first_cell_of_size(size);
-
-	// remove this cell from the free list
-	split_and_remove_cell(cell, size);
-	// return the properly incremented pointer
-	header* h = (header*) cell;
-	h->size = size;
-	pthread_mutex_unlock(&mutex);
-	return ((void*) h) + sizeof(size_t);
+static
+int
+medium_bin(size_t size)
+{
+	size_t bin = size / MEDIUM_BIN_WIDTH;
+	return bin < MEDIUM_BINS ? bin : MEDIUM_BINS - 1;
 }
 
 void
-opt_free(void* item)
+bin_insert(free_cell* cell)
 {
-	pthread_mutex_lock(&mutex);
-	stats.chunks_freed += 1;
-	header* h = (header*) (item - sizeof(size_t));
-	size_t size = h->size;
-	
+	int bin = medium_bin(cell->size);
+	stat_add(&stats.free_length, 1);
+	cell->prev = 0;
+	cell->next = medium_bins[bin];
+	if (cell->next != 0) {
+		cell->next->prev = cell;
+	}
+	medium_bins[bin] = cell;
+}
 
-	if (size < PAGE_SIZE) {
-		insert_chunk_into_list(h);
+void
+bin_remove(free_cell* cell)
+{
+	stat_add(&stats.free_length, -1);
+	if (cell->prev != 0) {
+		cell->prev->next = cell->next;
 	} else {
-		deallocate_pages(h);
+		medium_bins[medium_bin(cell->size)] = cell->next;
+	}
+	if (cell->next != 0) {
+		cell->next->prev = cell->prev;
 	}
-	pthread_mutex_unlock(&mutex);
 }
 
-void*
-opt_realloc(void* prev, size_t size)
+/**
+ * Reserves a heap region of the given size and the per-page metadata
+ * that goes with it. Returns false if either mapping fails.
+ */
+static
+bool
+reserve_region(size_t size)
 {
-	pthread_mutex_lock(&mutex);
-	// if free after, expand...
-	printf("Realloc.\n");
-	size_t current_size = *((long*) (prev - sizeof(size_t)));
-	void* next_cell = prev + current_size;
-	
-	free_cell* available =  free_cell_at_address(next_cell);
-	
-	if (available != 0 && available->size + current_size <= size) {
-		split_and_remove_cell(available, size - current_size);
-		available->size = 0;
-		available->next = 0;
-		available->prev = 0;
-		*((long*) (prev - sizeof(size_t))) = size;
-		pthread_mutex_unlock(&mutex);
-		printf("Done.\n");
-		return prev;
+	void* region = hugepages
+		? map_huge_aligned(size, PROT_NONE, MAP_NORESERVE)
+		: mmap(0, size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (region == MAP_FAILED) {
+		return false;
 	}
-	
-	// else hmalloc and copy, then hfree
-	pthread_mutex_unlock(&mutex);
-	void* new_mem = opt_malloc(size);
-	int rv = *((int*)memcpy(new_mem, prev, current_size));
+	size_t pages = size / PAGE_SIZE;
+	size_t meta_size = pages * (1 + sizeof(slab_page*)) + size / HUGE_PAGE_SIZE;
+	void* meta = mmap(0, meta_size, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (meta == MAP_FAILED) {
+		munmap(region, size);
+		return false;
+	}
+	clean_slabs = (slab_page**) meta;
+	page_state = (unsigned char*) (meta + pages * sizeof(slab_page*));
+	huge_split = page_state + pages;
+
+	heap_base = region;
+	heap_size = size;
+	heap_low = region;
+	heap_high = region + size;
+	return true;
+}
+
+/**
+ * Reserves the heap region, halving the size until the reservation
+ * fits under the address-space limit. Must be called with the mutex
+ * held.
+ */
+bool
+reserve_heap()
+{
+	pthread_once(&tuning_once, load_tuning);
+	for (size_t size = HEAP_REGION_SIZE; size >= HEAP_REGION_MIN; size /= 2) {
+		if (reserve_region(size)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Carves zeroed allocator metadata from pages of its own. The size must
+ * be a multiple of 64 bytes. Called with the mutex held; metadata is
+ * never freed.
+ */
+static
+void*
+meta_carve(size_t bytes)
+{
+	if (heap_meta_next + bytes > heap_meta_end) {
+		size_t num_pages = div_up(bytes, PAGE_SIZE);
+		heap_meta_next = allocate_pages(num_pages);
+		heap_meta_end = heap_meta_next + num_pages * PAGE_SIZE;
+		if (heap_meta_next == 0) {
+			pthread_mutex_unlock(&mutex);
+			perror("Whoops");
+			abort();
+		}
+	}
+	void* meta = heap_meta_next;
+	heap_meta_next += bytes;
+	return meta;
+}
+
+/**
+ * Commits the next superblock of the heap region for the given kind,
+ * from the top of the region for the medium heap and from the bottom
+ * otherwise. Returns 0 once the region is used up.
+ * Must be called with the mutex held.
+ */
+void*
+take_superblock(int kind)
+{
+	if (heap_base == 0 && !reserve_heap()) {
+		return 0;
+	}
+	if (heap_low == heap_high) {
+		return 0;
+	}
+
+	void* sb = kind == SB_MEDIUM ? heap_high - SUPERBLOCK_SIZE : heap_low;
+	size_t index = (sb - heap_base) / SUPERBLOCK_SIZE;
+	int rv = 0;
+	if (hugepages) {
+		// a huge page holds two superblocks; the first one taken commits it.
+		size_t buddy = index ^ 1;
+		if (sb_kind[buddy] == SB_UNUSED) {
+			rv = mprotect(heap_base + (index & ~1UL) * SUPERBLOCK_SIZE,
+					HUGE_PAGE_SIZE, PROT_READ|PROT_WRITE);
+			if (rv == 0) {
+				stat_add(&stats.huge_bytes, HUGE_PAGE_SIZE);
+			}
+		}
+	} else {
+		rv = mprotect(sb, SUPERBLOCK_SIZE, PROT_READ|PROT_WRITE);
+	}
+	if (rv == -1) {
+		return 0;
+	}
+
+	if (kind == SB_MEDIUM) {
+		heap_high = sb;
+	} else {
+		heap_low = sb + SUPERBLOCK_SIZE;
+	}
+	stat_add(&stats.pages_mapped, SUPERBLOCK_SIZE / PAGE_SIZE);
+	if (kind == SB_RUN) {
+		page_map[index] = (unsigned char*) meta_carve(SB_PAGES);
+	}
+	sb_kind[index] = kind;
+	return sb;
+}
+
+/**
+ * Takes num_pages contiguous pages from the given source, starting a new
+ * superblock when the current one can't fit them; the old superblock's
+ * tail is left unused. Must be called with the mutex held.
+ */
+void*
+source_pages(page_source* src, size_t num_pages)
+{
+	size_t bytes = num_pages * PAGE_SIZE;
+	if (src->next + bytes > src->end) {
+		void* sb = take_superblock(src->kind);
+		if (sb == 0) {
+			return 0;
+		}
+		src->next = sb;
+		src->end = sb + SUPERBLOCK_SIZE;
+	}
+	void* pages = src->next;
+	src->next += bytes;
+	return pages;
+}
+
+/**
+ * Inserts the given medium chunk into the free bins, first merging it
+ * with whichever of its physical neighbours are free, and returns the
+ * merged chunk. Must be called with the mutex held.
+ */
+free_cell*
+insert_chunk_into_list(header* h)
+{
+	size_t size = chunk_size(h);
+
+	size_t prev_tag = *((size_t*) (((void*) h) - sizeof(size_t)));
+	if ((prev_tag & IN_USE) == 0) {
+		free_cell* prev = (free_cell*) (((void*) h) - prev_tag);
+		bin_remove(prev);
+		h = (header*) prev;
+		size += prev_tag;
+	}
+
+	header* next = (header*) (((void*) h) + size);
+	if ((next->size & IN_USE) == 0) {
+		bin_remove((free_cell*) next);
+		size += next->size;
+	}
+
+	set_tags(h, size, false);
+	bin_insert((free_cell*) h);
+	return (free_cell*) h;
+}
+
+/**
+ * Grows the medium heap by one superblock below its current bottom and
+ * returns the resulting free chunk. The new chunk covers the old bottom
+ * fence word, so it merges with a free chunk at the old bottom.
+ * Must be called with the mutex held.
+ */
+free_cell*
+add_memory()
+{
+	void* sb = take_superblock(SB_MEDIUM);
+	if (sb == 0) {
+		return 0;
+	}
+	// fresh pages are as clean as scavenged ones.
+	memset(page_state + (sb - heap_base) / PAGE_SIZE, PAGE_CLEAN, SUPERBLOCK_SIZE / PAGE_SIZE);
+	*((size_t*) sb) = IN_USE;
+	header* h = (header*) (sb + sizeof(size_t));
+
+	if (medium_low == 0) {
+		*((size_t*) (sb + SUPERBLOCK_SIZE - sizeof(size_t))) = IN_USE;
+		set_tags(h, SUPERBLOCK_SIZE - 2 * sizeof(size_t), false);
+		bin_insert((free_cell*) h);
+		medium_low = sb;
+		return (free_cell*) h;
+	}
+
+	assert(sb + SUPERBLOCK_SIZE == medium_low);
+	medium_low = sb;
+	h->size = SUPERBLOCK_SIZE;
+	return insert_chunk_into_list(h);
+}
+
+/**
+ * Returns a free medium chunk of at least the given size,
+ * obtaining new memory if necessary. Returns 0 if out of memory.
+ */
+free_cell*
+first_cell_of_size(size_t size)
+{
+	assert(size <= MEDIUM_MAX);
+
+	for (int bin = medium_bin(size); bin < MEDIUM_BINS; ++bin) {
+		for (free_cell* cell = medium_bins[bin]; cell != 0; cell = cell->next) {
+			if (cell->size >= size) {
+				return cell;
+			}
+		}
+	}
+
+	free_cell* cell = add_memory();
+	if (cell == 0 || cell->size < size) {
+		return 0;
+	}
+	return cell;
+}
+
+/**
+ * Removes the cell from its bin and cuts size bytes off its front,
+ * binning the remainder if it is big enough to be a chunk of its own.
+ */
+void
+split_and_remove_cell(free_cell* cell, size_t size)
+{
+	assert(cell != 0 && cell->size >= size);
+	bin_remove(cell);
+
+	size_t rest = cell->size - size;
+	if (rest >= MEDIUM_MIN) {
+		free_cell* split = (free_cell*) (((void*) cell) + size);
+		set_tags((header*) split, rest, false);
+		bin_insert(split);
+		set_tags((header*) cell, size, true);
+	} else {
+		set_tags((header*) cell, cell->size, true);
+	}
+}
+
+/**
+ * Hands the pages in the given range back to the kernel and counts them.
+ * Takes the region's huge pages it touches out of huge_bytes, once each.
+ * Returns whether they now read as zero.
+ */
+static
+bool
+scavenge_range(void* from, void* to)
+{
+	if (from >= to) {
+		return true;
+	}
+	int rv = madvise(from, to - from, MADV_DONTNEED);
+	if (rv == 0) {
+		stat_add(&stats.scavenged_bytes, to - from);
+	}
+	if (rv == 0 && hugepages && from >= heap_base && from < heap_base + heap_size) {
+		size_t first = (from - heap_base) / HUGE_PAGE_SIZE;
+		size_t last = (to - 1 - heap_base) / HUGE_PAGE_SIZE;
+		for (size_t ii = first; ii <= last; ++ii) {
+			if (!huge_split[ii]) {
+				huge_split[ii] = 1;
+				stat_add(&stats.huge_bytes, -(long) HUGE_PAGE_SIZE);
+			}
+		}
+	}
+	return rv == 0;
+}
+
+/**
+ * Scavenges the pooled slab pages that have been free for an interval.
+ * The pool is newest first, so they are all at its end.
+ */
+static
+void
+scavenge_slabs(long now)
+{
+	slab_page** link = &empty_slabs;
+	while (*link != 0 && now - (long) (*link)->free_map[0] < scavenge_ms) {
+		link = &((*link)->next);
+	}
+	slab_page* page = *link;
+	*link = 0;
+	while (page != 0) {
+		slab_page* next = page->next;
+		scavenge_range(page, ((void*) page) + PAGE_SIZE);
+		clean_slabs[clean_slab_count++] = page;
+		page = next;
+	}
+}
+
+/**
+ * Ages the whole pages inside free medium chunks, scavenging runs of
+ * them that were already idle at the last pass. Only chunks in the last
+ * bin are big enough to hold a whole page.
+ */
+static
+void
+scavenge_medium()
+{
+	for (free_cell* cell = medium_bins[MEDIUM_BINS - 1]; cell != 0; cell = cell->next) {
+		uintptr_t start = (uintptr_t) cell + sizeof(free_cell);
+		uintptr_t end = (uintptr_t) cell + cell->size - sizeof(size_t);
+		void* from = (void*) ((start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+		void* to = (void*) (end & ~(PAGE_SIZE - 1));
+
+		void* run = 0;
+		for (void* pg = from; pg < to; pg += PAGE_SIZE) {
+			unsigned char* state = &(page_state[(pg - heap_base) / PAGE_SIZE]);
+			if (*state == PAGE_IDLE) {
+				*state = PAGE_CLEAN;
+				if (run == 0) {
+					run = pg;
+				}
+				continue;
+			}
+			if (*state == PAGE_DIRTY) {
+				*state = PAGE_IDLE;
+			}
+			if (run != 0) {
+				scavenge_range(run, pg);
+				run = 0;
+			}
+		}
+		if (run != 0) {
+			scavenge_range(run, to);
+		}
+	}
+}
+
+/**
+ * Scavenges every cached span idle for an interval, except the first
+ * page, which holds the span itself.
+ */
+static
+void
+scavenge_spans(long now)
+{
+	for (span* sp = span_oldest; sp != 0 && now - sp->freed_ms >= scavenge_ms; sp = sp->newer) {
+		if (!sp->zeroed) {
+			sp->zeroed = scavenge_range(((void*) sp) + PAGE_SIZE, ((void*) sp) + sp->size);
+			if (sp->zeroed && hugepages) {
+				stat_add(&stats.huge_bytes, -huge_bytes_in(sp, sp->size));
+			}
+		}
+	}
+}
+
+/**
+ * Runs a scavenger pass if an interval has passed since the last one.
+ * Only looks at the clock every SCAVENGE_TICKS calls, so it is cheap
+ * enough for every slow path. Must be called with the mutex held.
+ */
+static
+void
+scavenge_maybe()
+{
+	if (++scavenge_tick % SCAVENGE_TICKS != 0) {
+		return;
+	}
+	pthread_once(&tuning_once, load_tuning);
+	long now = now_ms();
+	if (now - last_scavenge_ms < scavenge_ms) {
+		return;
+	}
+	last_scavenge_ms = now;
+
+	scavenge_slabs(now);
+	scavenge_medium();
+	scavenge_spans(now);
+}
+
+/**
+ * Takes a medium chunk of the given size out of the free bins and tags
+ * it in use, or returns 0 if out of memory.
+ * Must be called with the mutex held.
+ */
+header*
+take_chunk(size_t size)
+{
+	scavenge_maybe();
+	free_cell* cell = first_cell_of_size(size);
+	if (cell == 0) {
+		return 0;
+	}
+	split_and_remove_cell(cell, size);
+	return (header*) cell;
+}
+
+/**
+ * Returns the index of the smallest size class that fits the given
+ * size, which must be at most SMALL_MAX.
+ */
+static
+int
+size_class(size_t size)
+{
+	assert(size > 0 && size <= SMALL_MAX);
+	return opt_request_class(size);
+}
+
+/**
+ * Returns the number of pages carved at a time for the given class.
+ */
+static
+size_t
+class_run_pages(int cls)
+{
+	size_t slot = class_sizes[cls];
+	size_t pages = 1;
+	while (pages < MAX_RUN_PAGES
+			&& ((pages * PAGE_SIZE) % slot) * 8 > pages * PAGE_SIZE) {
+		pages += 1;
+	}
+	return pages;
+}
+
+/**
+ * Carves a fresh run of pages into free objects of the given class,
+ * records the class in the page map and pushes the objects onto the
+ * class's shared bin. Must be called with the mutex held.
+ */
+void
+carve_run(int cls)
+{
+	size_t slot = class_sizes[cls];
+	size_t pages = class_run_pages(cls);
+	void* run = source_pages(&run_source, pages);
+	if (run == 0) {
+		return;
+	}
+	size_t offset = run - heap_base;
+	unsigned char* leaf = page_map[offset / SUPERBLOCK_SIZE];
+	memset(leaf + (offset % SUPERBLOCK_SIZE) / PAGE_SIZE, cls, pages);
+
+	size_t count = (pages * PAGE_SIZE) / slot;
+	for (size_t ii = count; ii > 0; --ii) {
+		void* item = run + (ii - 1) * slot;
+		*((void**) item) = central[cls].head;
+		central[cls].head = item;
+	}
+	central[cls].count += count;
+}
+
+/**
+ * Returns what the superblock holding the given pointer is used for, or
+ * SB_UNUSED for pointers outside the heap region.
+ */
+static
+int
+region_kind(void* item)
+{
+	uintptr_t offset = item - heap_base;
+	return offset < heap_size ? sb_kind[offset / SUPERBLOCK_SIZE] : SB_UNUSED;
+}
+
+/**
+ * Looks up the size class of a class-run object in the page map.
+ */
+static
+int
+run_class(void* item)
+{
+	uintptr_t offset = item - heap_base;
+	return page_map[offset / SUPERBLOCK_SIZE][(offset % SUPERBLOCK_SIZE) / PAGE_SIZE];
+}
+
+static
+slab_page*
+slab_page_of(void* item)
+{
+	return (slab_page*) (((uintptr_t) item) & ~(PAGE_SIZE - 1));
+}
+
+static
+int
+slab_slots(int cls)
+{
+	return (PAGE_SIZE - SLAB_HEADER) / class_sizes[cls];
+}
+
+static
+void
+slab_push(tcache* heap, slab_page* page)
+{
+	page->prev = 0;
+	page->next = heap->partial[page->cls];
+	if (page->next != 0) {
+		page->next->prev = page;
+	}
+	heap->partial[page->cls] = page;
+}
+
+static
+void
+slab_unlink(slab_page* page)
+{
+	if (page->prev != 0) {
+		page->prev->next = page->next;
+	} else {
+		page->owner->partial[page->cls] = page->next;
+	}
+	if (page->next != 0) {
+		page->next->prev = page->prev;
+	}
+}
+
+/**
+ * Takes a slab page for the given heap, preferring a pooled page, then a
+ * scavenged one, then a fresh one, and puts it on the heap's partial
+ * list of the class. Returns 0 if the heap region is used up.
+ */
+slab_page*
+new_slab_page(tcache* heap, int cls)
+{
+	mutex_lock(HM_LOCK_REFILL);
+	scavenge_maybe();
+	slab_page* page = empty_slabs;
+	if (page != 0) {
+		empty_slabs = page->next;
+	} else if (clean_slab_count > 0) {
+		page = clean_slabs[--clean_slab_count];
+	} else {
+		page = (slab_page*) source_pages(&slab_source, 1);
+	}
+	pthread_mutex_unlock(&mutex);
+	if (page == 0) {
+		return 0;
+	}
+
+	int slots = slab_slots(cls);
+	for (int ww = 0; ww < SLAB_MAP_WORDS; ++ww) {
+		int bits = slots - 64 * ww;
+		if (bits >= 64) {
+			page->free_map[ww] = ~0UL;
+		} else if (bits > 0) {
+			page->free_map[ww] = (1UL << bits) - 1;
+		} else {
+			page->free_map[ww] = 0;
+		}
+	}
+	page->owner = heap;
+	page->cls = cls;
+	page->free_count = slots;
+	slab_push(heap, page);
+	return page;
+}
+
+/**
+ * Gives an entirely free slab page up to the shared pool. A pooled
+ * page's bitmap is unused, so its first word holds the time it was
+ * pooled.
+ */
+static
+void
+slab_retire(slab_page* page)
+{
+	slab_unlink(page);
+	mutex_lock(HM_LOCK_FREE);
+	page->free_map[0] = now_ms();
+	page->next = empty_slabs;
+	empty_slabs = page;
+	scavenge_maybe();
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Moves up to want free slots of the given slab class into the heap's
+ * bin, taking them from the heap's partially used pages with
+ * find-first-set on the page bitmaps. Slots are pushed highest first so
+ * the bin hands them out in address order.
+ */
+void
+slab_fill(tcache* heap, int cls, int want)
+{
+	class_bin* bin = &(heap->fast.bins[cls]);
+	size_t slot = class_sizes[cls];
+	while (want > 0) {
+		slab_page* page = heap->partial[cls];
+		if (page == 0) {
+			page = new_slab_page(heap, cls);
+			if (page == 0) {
+				return;
+			}
+		}
+
+		for (int ww = SLAB_MAP_WORDS - 1; ww >= 0 && want > 0; --ww) {
+			while (page->free_map[ww] != 0 && want > 0) {
+				int bit = 63 - __builtin_clzl(page->free_map[ww]);
+				page->free_map[ww] &= ~(1UL << bit);
+				page->free_count -= 1;
+				want -= 1;
+
+				void* item = ((void*) page) + SLAB_HEADER + (64 * ww + bit) * slot;
+				*((void**) item) = bin->head;
+				bin->head = item;
+				bin->count += 1;
+			}
+		}
+
+		if (page->free_count == 0) {
+			slab_unlink(page);
+		}
+	}
+}
+
+/**
+ * Marks a slab object's slot free again, putting its page back on its
+ * owner's partial list if it had been full. A page left entirely free
+ * is retired to the pool unless it is the class's only partial page.
+ * Only the owning heap's thread may call this.
+ */
+void
+slab_release(void* item)
+{
+	slab_page* page = slab_page_of(item);
+	int idx = (item - ((void*) page) - SLAB_HEADER) / class_sizes[page->cls];
+	page->free_map[idx / 64] |= 1UL << (idx % 64);
+	if (page->free_count == 0) {
+		slab_push(page->owner, page);
+	}
+	page->free_count += 1;
+
+	if (page->free_count == slab_slots(page->cls)
+			&& (page->prev != 0 || page->next != 0)) {
+		slab_retire(page);
+	}
+}
+
+/**
+ * Pushes a slab object freed by a thread other than its owner onto the
+ * owning heap's remote list. Lock-free; safe from any thread.
+ */
+void
+remote_free(tcache* owner, void* item)
+{
+	void* head = __atomic_load_n(&(owner->remote), __ATOMIC_RELAXED);
+	do {
+		*((void**) item) = head;
+	} while (!__atomic_compare_exchange_n(&(owner->remote), &head, item,
+				true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * Takes every object other threads have freed to this heap and returns
+ * each to its slab page.
+ */
+void
+remote_drain(tcache* heap)
+{
+	if (__atomic_load_n(&(heap->remote), __ATOMIC_RELAXED) == 0) {
+		return;
+	}
+	void* item = __atomic_exchange_n(&(heap->remote), 0, __ATOMIC_ACQUIRE);
+	while (item != 0) {
+		void* next = *((void**) item);
+		slab_release(item);
+		item = next;
+	}
+}
+
+/**
+ * Moves up to count chunks from the given cache bin back to their slab
+ * pages, or to the shared bin of the same class.
+ */
+void
+cache_release(tcache* heap, int cls, long count)
+{
+	class_bin* bin = &(heap->fast.bins[cls]);
+	if (cls < SLAB_CLASSES) {
+		while (bin->head != 0 && count > 0) {
+			void* item = bin->head;
+			bin->head = *((void**) item);
+			bin->count -= 1;
+			count -= 1;
+			slab_release(item);
+		}
+		return;
+	}
+
+	mutex_lock(HM_LOCK_FREE);
+	while (bin->head != 0 && count > 0) {
+		void* item = bin->head;
+		bin->head = *((void**) item);
+		bin->count -= 1;
+		count -= 1;
+		*((void**) item) = central[cls].head;
+		central[cls].head = item;
+		central[cls].count += 1;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Carves a new zeroed heap and links it into the list of all heaps.
+ * Called with the mutex held.
+ */
+static
+tcache*
+new_heap()
+{
+	tcache* heap = (tcache*) meta_carve(sizeof(tcache));
+	heap->next_heap = all_heaps;
+	__atomic_store_n(&all_heaps, heap, __ATOMIC_RELEASE);
+	return heap;
+}
+
+#ifdef OPT_PERCPU
+
+static
+int
+current_cpu()
+{
+#ifdef RSEQ_SIG
+	if (__rseq_size > 0) {
+		struct rseq* rs = (struct rseq*) (((char*) __builtin_thread_pointer()) + __rseq_offset);
+		int cpu = (int) __atomic_load_n(&(rs->cpu_id), __ATOMIC_RELAXED);
+		if (cpu >= 0) {
+			return cpu % MAX_CPUS;
+		}
+	}
+#endif
+	int cpu = sched_getcpu();
+	return cpu < 0 ? 0 : cpu % MAX_CPUS;
+}
+
+/**
+ * Takes a CPU heap's spin lock, counting the acquisition against the
+ * calling site when built with OPT_LOCKSTAT.
+ */
+static
+void
+heap_lock(tcache* heap, int site)
+{
+#ifdef OPT_LOCKSTAT
+	long start = 0;
+#endif
+	while (__atomic_load_n(&(heap->lock), __ATOMIC_RELAXED)
+			|| __atomic_exchange_n(&(heap->lock), 1, __ATOMIC_ACQUIRE)) {
+#ifdef OPT_LOCKSTAT
+		if (start == 0) {
+			start = now_ns();
+		}
+#endif
+		sched_yield();
+	}
+#ifdef OPT_LOCKSTAT
+	lock_record(&(heap->locks[site]), start);
+#endif
+}
+
+/**
+ * Returns the heap of the CPU the caller is running on, locked on
+ * behalf of the given call site.
+ */
+static
+tcache*
+heap_acquire(int site)
+{
+	int cpu = current_cpu();
+	tcache* heap = __atomic_load_n(&(cpu_heaps[cpu]), __ATOMIC_ACQUIRE);
+	if (heap == 0) {
+		// re-check under the mutex, so only one heap is ever carved per CPU.
+		mutex_lock(HM_LOCK_OTHER);
+		heap = __atomic_load_n(&(cpu_heaps[cpu]), __ATOMIC_ACQUIRE);
+		if (heap == 0) {
+			heap = new_heap();
+			__atomic_store_n(&(cpu_heaps[cpu]), heap, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&mutex);
+	}
+
+	heap_lock(heap, site);
+	return heap;
+}
+
+static
+void
+heap_release(tcache* heap)
+{
+	__atomic_store_n(&(heap->lock), 0, __ATOMIC_RELEASE);
+}
+
+#else
+
+/**
+ * Thread exit hook: hands every cached chunk back to its slab page or
+ * shared bin and leaves the heap to be adopted by a later thread.
+ */
+static
+void
+cache_destroy(void* arg)
+{
+	tcache* heap = (tcache*) arg;
+	for (int ii = 0; ii < NUM_CLASSES; ++ii) {
+		cache_release(heap, ii, heap->fast.bins[ii].count);
+	}
+	remote_drain(heap);
+	cache = 0;
+	opt_fast_heap = 0;
+
+	mutex_lock(HM_LOCK_OTHER);
+	heap->next_free = abandoned_heaps;
+	abandoned_heaps = heap;
+	pthread_mutex_unlock(&mutex);
+}
+
+static
+void
+cache_make_key()
+{
+	pthread_key_create(&cache_key, cache_destroy);
+}
+
+/**
+ * Gives the calling thread a heap, adopting one left by an exited thread
+ * if there is one, and registers the exit hook.
+ */
+static
+tcache*
+heap_attach()
+{
+	pthread_once(&cache_key_once, cache_make_key);
+
+	mutex_lock(HM_LOCK_OTHER);
+	tcache* heap = abandoned_heaps;
+	if (heap != 0) {
+		abandoned_heaps = heap->next_free;
+	} else {
+		heap = new_heap();
+	}
+	pthread_mutex_unlock(&mutex);
+
+	pthread_setspecific(cache_key, heap);
+	cache = heap;
+#if !defined(OPT_PROFILE) && !defined(OPT_DEBUG)
+	opt_fast_heap = &(heap->fast);
+#endif
+	return heap;
+}
+
+/**
+ * Returns the calling thread's heap. Thread heaps take no lock, so the
+ * call site is unused.
+ */
+static
+tcache*
+heap_acquire(int site)
+{
+	tcache* heap = cache;
+	if (heap == 0) {
+		heap = heap_attach();
+	}
+	return heap;
+}
+
+static
+void
+heap_release(tcache* heap)
+{
+}
+
+#endif
+
+/*
+ * fork() must not happen while another thread holds the mutex or a CPU
+ * heap's lock, or the child would inherit it locked forever. Heap locks
+ * are taken before the mutex, as everywhere else.
+ */
+static
+void
+fork_prepare()
+{
+#ifdef OPT_PERCPU
+	for (int ii = 0; ii < MAX_CPUS; ++ii) {
+		if (cpu_heaps[ii] != 0) {
+			heap_lock(cpu_heaps[ii], HM_LOCK_OTHER);
+		}
+	}
+#endif
+	mutex_lock(HM_LOCK_OTHER);
+}
+
+static
+void
+fork_release()
+{
+	pthread_mutex_unlock(&mutex);
+#ifdef OPT_PERCPU
+	for (int ii = 0; ii < MAX_CPUS; ++ii) {
+		if (cpu_heaps[ii] != 0) {
+			heap_release(cpu_heaps[ii]);
+		}
+	}
+#endif
+}
+
+__attribute__((constructor))
+static
+void
+fork_hooks()
+{
+	pthread_atfork(fork_prepare, fork_release, fork_release);
+}
+
+/**
+ * Refills the cache bin for the given class with want chunks, or a
+ * batch if that is more, from the heap's own slab pages for the slab
+ * classes or from the shared bin under a single lock acquisition
+ * otherwise.
+ */
+void
+cache_refill(tcache* heap, int cls, long want)
+{
+	if (want < TCACHE_BATCH) {
+		want = TCACHE_BATCH;
+	}
+	if (cls < SLAB_CLASSES) {
+		remote_drain(heap);
+		slab_fill(heap, cls, want);
+		return;
+	}
+
+	class_bin* bin = &(heap->fast.bins[cls]);
+	mutex_lock(HM_LOCK_REFILL);
+	for (long ii = 0; ii < want; ++ii) {
+		if (central[cls].head == 0) {
+			carve_run(cls);
+			if (central[cls].head == 0) {
+				break;
+			}
+		}
+		void* item = central[cls].head;
+		central[cls].head = *((void**) item);
+		central[cls].count -= 1;
+		*((void**) item) = bin->head;
+		bin->head = item;
+		bin->count += 1;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Returns the number of bytes the caller may use at the given pointer.
+ */
+static
+size_t
+usable_size(void* item)
+{
+	int kind = region_kind(item);
+	if (kind == SB_SLAB) {
+		return class_sizes[slab_page_of(item)->cls];
+	}
+	if (kind == SB_RUN) {
+		return class_sizes[run_class(item)];
+	}
+
+	header* h = (header*) (item - sizeof(size_t));
+	if (h->size & ALIGNED) {
+		size_t offset = h->size & ~ALIGNED;
+		return usable_size(item - offset) - offset;
+	}
+	if (h->size & IN_USE) {
+		return chunk_size(h) - 2 * sizeof(size_t);
+	}
+	return h->size - LARGE_HEADER;
+}
+
+size_t
+opt_usable_size(void* item)
+{
+	return item == 0 ? 0 : usable_size(item);
+}
+
+/**
+ * Copies a large chunk's size next to the pointer handed out for it and
+ * returns that pointer.
+ */
+static
+void*
+large_item(header* h)
+{
+	h[1].size = h->size;
+	return ((void*) h) + LARGE_HEADER;
+}
+
+/**
+ * Resizes a large chunk's mapping with mremap, letting the kernel move
+ * the pages instead of copying their contents. With huge pages on, a
+ * chunk that can't grow in place is moved to a huge-page boundary, so
+ * huge pages it already has move whole. Returns 0 on failure.
+ */
+header*
+remap_pages(header* h, size_t num_pages)
+{
+	size_t old_size = h->size;
+	size_t new_size = num_pages * PAGE_SIZE;
+	void* ptr = MAP_FAILED;
+	if (hugepages && new_size >= HUGE_PAGE_SIZE) {
+		ptr = mremap(h, old_size, new_size, 0);
+		if (ptr == MAP_FAILED) {
+			void* target = map_huge_aligned(new_size, PROT_READ|PROT_WRITE, 0);
+			if (target != MAP_FAILED) {
+				ptr = mremap(h, old_size, new_size, MREMAP_MAYMOVE|MREMAP_FIXED, target);
+				if (ptr == MAP_FAILED) {
+					munmap(target, new_size);
+				}
+			}
+		}
+		if (ptr != MAP_FAILED) {
+			madvise(ptr, new_size, MADV_HUGEPAGE);
+		}
+	} else {
+		ptr = mremap(h, old_size, new_size, MREMAP_MAYMOVE);
+	}
+	if (ptr == MAP_FAILED) {
+		return 0;
+	}
+	mutex_lock(HM_LOCK_REALLOC);
+	stat_add(&stats.pages_mapped, (long) (new_size - old_size) / (long) PAGE_SIZE);
+	if (hugepages) {
+		stat_add(&stats.huge_bytes, huge_bytes_in(ptr, new_size) - huge_bytes_in(h, old_size));
+	}
+	pthread_mutex_unlock(&mutex);
+
+	h = (header*) ptr;
+	h->size = new_size;
+	return h;
+}
+
+/**
+ * Allocates a large chunk of at least size bytes, reusing a cached span
+ * if there is one that fits. Sets dirty to the number of bytes at the
+ * start of the chunk that may not be zero: none for fresh pages, all of
+ * a recycled span, or just its first page if it was zeroed.
+ */
+static
+void*
+large_alloc(size_t size, size_t* dirty)
+{
+	pthread_once(&tuning_once, load_tuning);
+	mutex_lock(HM_LOCK_MALLOC);
+	scavenge_maybe();
+	size_t num_pages = div_up(size + LARGE_HEADER, PAGE_SIZE);
+	header* h = span_take(num_pages);
+	if (h != 0) {
+		bool zeroed = ((span*) h)->zeroed;
+		*dirty = (zeroed ? PAGE_SIZE : h->size) - LARGE_HEADER;
+	} else {
+		h = (header*) allocate_pages(num_pages);
+		if (h == 0) {
+			pthread_mutex_unlock(&mutex);
+			return 0;
+		}
+		h->size = num_pages * PAGE_SIZE;
+		*dirty = 0;
+	}
+	stat_add(&stats.chunks_allocated, 1);
+	pthread_mutex_unlock(&mutex);
+	return large_item(h);
+}
+
+/**
+ * Returns the medium chunk size needed for a request: header, payload
+ * and footer, rounded so chunks stay 16-byte aligned.
+ */
+static
+size_t
+medium_chunk_size(size_t size)
+{
+	return div_up(size + 2 * sizeof(size_t), 16) * 16;
+}
+
+/**
+ * Pops an object of the given class from this thread's cache,
+ * refilling the bin first if it is empty.
+ */
+static
+void*
+cache_alloc(int cls)
+{
+	tcache* heap = heap_acquire(HM_LOCK_MALLOC);
+	class_bin* bin = &(heap->fast.bins[cls]);
+	if (bin->head == 0) {
+		cache_refill(heap, cls, TCACHE_BATCH);
+		if (bin->head == 0) {
+			heap_release(heap);
+			return 0;
+		}
+	}
+	void* item = bin->head;
+	bin->head = *((void**) item);
+	bin->count -= 1;
+	stat_add(&(heap->fast.allocs), 1);
+	heap_release(heap);
+	return item;
+}
+
+/**
+ * Pushes an object of the given class onto the given heap's cache,
+ * trimming the bin if it has grown past its limit.
+ */
+static
+void
+cache_free(tcache* heap, int cls, void* item)
+{
+	class_bin* bin = &(heap->fast.bins[cls]);
+	*((void**) item) = bin->head;
+	bin->head = item;
+	bin->count += 1;
+	stat_add(&(heap->fast.frees), 1);
+	if (bin->count > TCACHE_LIMIT) {
+		cache_release(heap, cls, bin->count - TCACHE_LIMIT / 2);
+	}
+}
+
+#ifdef OPT_PROFILE
+
+static
+uint64_t
+prof_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Returns the size histogram bucket for a request: bucket b counts
+ * sizes from 2^(b-1) up to 2^b - 1, and the last one everything above.
+ */
+static
+int
+prof_size_bucket(size_t size)
+{
+	int bb = size == 0 ? 0 : 64 - __builtin_clzl(size);
+	return bb < HM_SIZE_BUCKETS ? bb : HM_SIZE_BUCKETS - 1;
+}
+
+/**
+ * Returns the latency histogram bucket for a cycle count: exact below
+ * PROF_SUB, then PROF_SUB buckets per doubling.
+ */
+static
+int
+prof_cycle_bucket(uint64_t cycles)
+{
+	if (cycles < PROF_SUB) {
+		return cycles;
+	}
+	int lg = 63 - __builtin_clzl(cycles);
+	int sub = (cycles >> (lg - PROF_SUB_BITS)) & (PROF_SUB - 1);
+	return (lg - PROF_SUB_BITS + 1) * PROF_SUB + sub;
+}
+
+/**
+ * Returns the largest cycle count that falls in the given bucket.
+ */
+static
+long
+prof_bucket_top(int bucket)
+{
+	if (bucket < PROF_SUB) {
+		return bucket;
+	}
+	int shift = bucket / PROF_SUB - 1;
+	long low = (long) (PROF_SUB + bucket % PROF_SUB) << shift;
+	return low + (1L << shift) - 1;
+}
+
+/**
+ * Thread exit hook: leaves the thread's block to a later thread.
+ */
+static
+void
+prof_detach(void* arg)
+{
+	prof_block* block = (prof_block*) arg;
+	prof = 0;
+
+	mutex_lock(HM_LOCK_OTHER);
+	block->next_free = idle_blocks;
+	idle_blocks = block;
+	pthread_mutex_unlock(&mutex);
+}
+
+static
+void
+prof_make_key()
+{
+	pthread_key_create(&prof_key, prof_detach);
+}
+
+/**
+ * Gives the calling thread a block, reusing an exited thread's block if
+ * there is one.
+ */
+static
+prof_block*
+prof_attach()
+{
+	pthread_once(&prof_key_once, prof_make_key);
+
+	mutex_lock(HM_LOCK_OTHER);
+	prof_block* block = idle_blocks;
+	if (block != 0) {
+		idle_blocks = block->next_free;
+	} else {
+		block = (prof_block*) meta_carve(sizeof(prof_block));
+		block->next_block = all_blocks;
+		__atomic_store_n(&all_blocks, block, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	pthread_setspecific(prof_key, block);
+	prof = block;
+	return block;
+}
+
+/**
+ * Records one call to an entry point that started at the given cycle
+ * count, with its request size unless it is a free.
+ */
+static
+void
+prof_record(int op, uint64_t start, size_t size)
+{
+	uint64_t cycles = prof_clock() - start;
+	prof_block* block = prof;
+	if (block == 0) {
+		block = prof_attach();
+	}
+	if (op != PROF_FREE) {
+		stat_add(&(block->sizes[prof_size_bucket(size)]), 1);
+	}
+	stat_add(&(block->cycles[op][prof_cycle_bucket(cycles)]), 1);
+}
+
+/**
+ * Returns the cycle count below which the given share (in thousandths)
+ * of the calls in a latency histogram fall.
+ */
+static
+long
+prof_percentile(long* hist, long calls, long permille)
+{
+	long rank = div_up(calls * permille, 1000);
+	long seen = 0;
+	for (int bb = 0; bb < PROF_BUCKETS; ++bb) {
+		seen += hist[bb];
+		if (seen >= rank) {
+			return prof_bucket_top(bb);
+		}
+	}
+	return 0;
+}
+
+static
+void
+prof_latency(long* hist, hm_latency* lat)
+{
+	lat->calls = 0;
+	for (int bb = 0; bb < PROF_BUCKETS; ++bb) {
+		lat->calls += hist[bb];
+	}
+	if (lat->calls > 0) {
+		lat->p50 = prof_percentile(hist, lat->calls, 500);
+		lat->p99 = prof_percentile(hist, lat->calls, 990);
+		lat->p999 = prof_percentile(hist, lat->calls, 999);
+	}
+}
+
+/**
+ * Profiling builds print their profile when the program exits.
+ */
+__attribute__((destructor))
+static
+void
+prof_report()
+{
+	hprintprofile();
+}
+
+#endif
+
+/**
+ * Returns a snapshot of the size histogram and of the latency
+ * percentiles of each entry point, merged over all threads. Latencies
+ * are in cycles, rounded up to the top of their histogram bucket, so
+ * they may read up to 1/PROF_SUB high. Everything is zero unless
+ * optmalloc was built with OPT_PROFILE. Takes no locks.
+ */
+hm_profile*
+hgetprofile()
+{
+    static __thread hm_profile snapshot;
+    memset(&snapshot, 0, sizeof(hm_profile));
+
+#ifdef OPT_PROFILE
+    long merged[PROF_OPS][PROF_BUCKETS];
+    memset(merged, 0, sizeof(merged));
+
+    prof_block* block = __atomic_load_n(&all_blocks, __ATOMIC_ACQUIRE);
+    for (; block != 0; block = block->next_block) {
+        for (int bb = 0; bb < HM_SIZE_BUCKETS; ++bb) {
+            snapshot.sizes[bb] += stat_read(&(block->sizes[bb]));
+        }
+        for (int op = 0; op < PROF_OPS; ++op) {
+            for (int bb = 0; bb < PROF_BUCKETS; ++bb) {
+                merged[op][bb] += stat_read(&(block->cycles[op][bb]));
+            }
+        }
+    }
+
+    prof_latency(merged[PROF_MALLOC], &snapshot.mallocs);
+    prof_latency(merged[PROF_FREE], &snapshot.frees);
+    prof_latency(merged[PROF_REALLOC], &snapshot.reallocs);
+#endif
+    return &snapshot;
+}
+
+void
+hprintprofile()
+{
+    hm_profile* pr = hgetprofile();
+    fprintf(stderr, "\n== husky malloc profile ==\n");
+#ifndef OPT_PROFILE
+    fprintf(stderr, "(built without OPT_PROFILE)\n");
+#endif
+    fprintf(stderr, "Request sizes:\n");
+    for (int bb = 0; bb < HM_SIZE_BUCKETS; ++bb) {
+        if (pr->sizes[bb] != 0) {
+            long low = bb == 0 ? 0 : 1L << (bb - 1);
+            fprintf(stderr, "  %10ld+: %ld\n", low, pr->sizes[bb]);
+        }
+    }
+    fprintf(stderr, "Cycles:       calls     p50     p99    p999\n");
+    fprintf(stderr, "  malloc:  %8ld %7ld %7ld %7ld\n", pr->mallocs.calls,
+            pr->mallocs.p50, pr->mallocs.p99, pr->mallocs.p999);
+    fprintf(stderr, "  free:    %8ld %7ld %7ld %7ld\n", pr->frees.calls,
+            pr->frees.p50, pr->frees.p99, pr->frees.p999);
+    fprintf(stderr, "  realloc: %8ld %7ld %7ld %7ld\n", pr->reallocs.calls,
+            pr->reallocs.p50, pr->reallocs.p99, pr->reallocs.p999);
+}
+
+/**
+ * Frees a slab object, to the calling thread's heap when it owns the
+ * page and through the owner's remote list otherwise.
+ */
+static
+void
+slab_free(void* item)
+{
+	slab_page* page = slab_page_of(item);
+	tcache* heap = heap_acquire(HM_LOCK_FREE);
+	if (page->owner == heap) {
+		cache_free(heap, page->cls, item);
+		heap_release(heap);
+	} else {
+		stat_add(&(heap->fast.frees), 1);
+		heap_release(heap);
+		remote_free(page->owner, item);
+	}
+}
+
+/**
+ * Frees a medium or large chunk, or an aligned pointer into one.
+ * Must be called with the mutex held.
+ */
+static
+void
+chunk_free(void* item)
+{
+	// opt_memalign only tags pointers into medium and large chunks.
+	header* h = (header*) (item - sizeof(size_t));
+	size_t size = h->size;
+
+	if (size & ALIGNED) {
+		item -= size & ~ALIGNED;
+		h = (header*) (item - sizeof(size_t));
+		size = h->size;
+	}
+
+	stat_add(&stats.chunks_freed, 1);
+	if (size & IN_USE) {
+		insert_chunk_into_list(h);
+	} else {
+		span_give((header*) (item - LARGE_HEADER));
+	}
+}
+
+#ifdef OPT_DEBUG
+/**
+ * Aborts unless size could be the size last requested for the object at
+ * item: it must fit the object and select the object's class.
+ */
+static
+void
+check_sized(void* item, size_t size)
+{
+	size_t usable = usable_size(item);
+	if (size > usable || opt_request_class(size) != opt_request_class(usable)) {
+		fprintf(stderr, "opt_free_sized: %ld bytes freed at %p, which holds %ld\n",
+				size, item, usable);
+		abort();
+	}
+}
+#endif
+
+/*
+ * Profiling builds compile the entry points below under untimed names,
+ * so calls between them are not counted twice, and wrap them in timed
+ * versions at the end of the file.
+ */
+#ifdef OPT_PROFILE
+#define opt_malloc  untimed_malloc
+#define opt_free    untimed_free
+#define opt_realloc untimed_realloc
+#define opt_free_sized untimed_free_sized
+#endif
+
+void*
+opt_malloc(size_t size)
+{
+	if (size <= SLAB_MAX) {
+		return cache_alloc(size == 0 ? 0 : (size - 1) / 16);
+	}
+
+	if (size <= SMALL_MAX) {
+		return cache_alloc(size_class(size));
+	}
+
+	if (size > PTRDIFF_MAX) {
+		return 0;
+	}
+
+	size_t chunk = medium_chunk_size(size);
+	if (chunk > MEDIUM_MAX) {
+		size_t dirty;
+		return large_alloc(size, &dirty);
+	}
+
+	mutex_lock(HM_LOCK_MALLOC);
+	header* h = take_chunk(chunk);
+	if (h == 0) {
+		pthread_mutex_unlock(&mutex);
+		return 0;
+	}
+	stat_add(&stats.chunks_allocated, 1);
+	pthread_mutex_unlock(&mutex);
+	// return the properly incremented pointer
+	return ((void*) h) + sizeof(size_t);
+}
+
+void
+opt_free(void* item)
+{
+	if (item == 0) {
+		return;
+	}
+
+	int kind = region_kind(item);
+	if (kind == SB_SLAB) {
+		slab_free(item);
+		return;
+	}
+	if (kind == SB_RUN) {
+		tcache* heap = heap_acquire(HM_LOCK_FREE);
+		cache_free(heap, run_class(item), item);
+		heap_release(heap);
+		return;
+	}
+
+	mutex_lock(HM_LOCK_FREE);
+	scavenge_maybe();
+	chunk_free(item);
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Frees an object given the size last requested for it from opt_malloc,
+ * opt_calloc or opt_realloc, which picks its class without looking the
+ * object up. Objects from opt_memalign must go to opt_free instead.
+ * Built with OPT_DEBUG, the size is checked against the object.
+ */
+void
+opt_free_sized(void* item, size_t size)
+{
+	if (item == 0) {
+		return;
+	}
+#ifdef OPT_DEBUG
+	check_sized(item, size);
+#endif
+
+	if (size <= SLAB_MAX) {
+		slab_free(item);
+	} else if (size <= SMALL_MAX) {
+		tcache* heap = heap_acquire(HM_LOCK_FREE);
+		cache_free(heap, size_class(size), item);
+		heap_release(heap);
+	} else {
+		opt_free(item);
+	}
+}
+
+void*
+opt_realloc(void* prev, size_t size)
+{
+	if (prev == 0) {
+		return opt_malloc(size);
+	}
+
+	size_t usable = usable_size(prev);
+	int kind = region_kind(prev);
+	header* h = (header*) (prev - sizeof(size_t));
+
+	// a shrinking large chunk gives back its spare pages, or moves to a
+	// medium chunk if it now fits one. Only a shrink that frees at least
+	// REMAP_MIN bytes and a quarter of the chunk is worth the syscall and
+	// the copy; a smaller one just keeps its slack.
+	size_t needed = medium_chunk_size(size);
+	bool large = kind == SB_UNUSED && !(h->size & ALIGNED);
+	bool shrink = false;
+	if (large && size <= usable) {
+		size_t spare = h->size - div_up(size + LARGE_HEADER, PAGE_SIZE) * PAGE_SIZE;
+		shrink = spare >= REMAP_MIN && spare >= h->size / 4;
+	}
+
+	// staying put while the class is unchanged keeps opt_free_sized right.
+	if (!shrink && size <= usable
+			&& opt_request_class(size) == opt_request_class(usable)) {
+		return prev;
+	}
+
+	if (shrink && needed > MEDIUM_MAX) {
+		header* moved = remap_pages((header*) (prev - LARGE_HEADER),
+				div_up(size + LARGE_HEADER, PAGE_SIZE));
+		if (moved != 0) {
+			return large_item(moved);
+		}
+		return prev;
+	}
+
+	// aligned pointers from opt_memalign are only ever moved, and so are
+	// class objects, which have no header to read, and shrinking chunks.
+	bool plain = size > usable && (kind == SB_MEDIUM || kind == SB_UNUSED)
+		&& !(h->size & ALIGNED);
+	if (plain && (h->size & IN_USE) && needed <= MEDIUM_MAX) {
+		size_t current_size = chunk_size(h);
+		// if the next chunk is free and big enough, expand into it.
+		mutex_lock(HM_LOCK_REALLOC);
+		header* next = (header*) (((void*) h) + current_size);
+
+		if ((next->size & IN_USE) == 0 && current_size + next->size >= needed) {
+			size_t grown = current_size + next->size;
+			bin_remove((free_cell*) next);
+			if (grown - needed >= MEDIUM_MIN) {
+				free_cell* rest = (free_cell*) (((void*) h) + needed);
+				set_tags((header*) rest, grown - needed, false);
+				bin_insert(rest);
+				grown = needed;
+			}
+			set_tags(h, grown, true);
+			pthread_mutex_unlock(&mutex);
+			return prev;
+		}
+		pthread_mutex_unlock(&mutex);
+	}
+
+	// big page-backed chunks are grown by remapping.
+	if (plain && h->size >= REMAP_MIN && !(h->size & IN_USE)) {
+		header* large = (header*) (prev - LARGE_HEADER);
+		header* moved = remap_pages(large, div_up(size + LARGE_HEADER, PAGE_SIZE));
+		if (moved != 0) {
+			return large_item(moved);
+		}
+	}
+	
+	// else malloc and copy, then free
+	void* new_mem = opt_malloc(size);
+	if (new_mem == 0) {
+		return 0;
+	}
+	memcpy(new_mem, prev, size < usable ? size : usable);
 	opt_free(prev);	
-	printf("Done.\n");
 	return new_mem;
 }
+
+/**
+ * Returns the smallest size class that fits a small request of the given
+ * size and whose objects are all aligned to align, at most
+ * MAX_CLASS_ALIGN. The 1024-byte class always qualifies.
+ */
+static
+int
+aligned_class(size_t size, size_t align)
+{
+	int cls = opt_request_class(size);
+	while (class_sizes[cls] % align != 0) {
+		cls += 1;
+	}
+	return cls;
+}
+
+/**
+ * Allocates size bytes at a multiple of align, which must be a power of
+ * two. The result can be passed to opt_free and opt_realloc like any
+ * other; opt_realloc keeps the alignment only while it resizes in place.
+ */
+void*
+opt_memalign(size_t align, size_t size)
+{
+	if (align == 0 || (align & (align - 1)) != 0) {
+		return 0;
+	}
+	if (align <= 16) {
+		return opt_malloc(size);
+	}
+	if (align <= MAX_CLASS_ALIGN && size <= SMALL_MAX) {
+		return cache_alloc(aligned_class(size, align));
+	}
+	if (size > PTRDIFF_MAX - align) {
+		return 0;
+	}
+
+	// opt_malloc is 16-byte aligned, so at most align - 16 bytes are skipped.
+	void* item = opt_malloc(size + align - 16);
+	if (item == 0) {
+		return 0;
+	}
+
+	void* aligned = (void*) ((((uintptr_t) item) + align - 1) & ~(align - 1));
+	if (aligned != item) {
+		((header*) (aligned - sizeof(size_t)))->size = (aligned - item) | ALIGNED;
+	}
+	return aligned;
+}
+
+void*
+opt_aligned_alloc(size_t align, size_t size)
+{
+	return opt_memalign(align, size);
+}
+
+/**
+ * Allocates zeroed memory for count objects of size bytes each. Small
+ * and medium chunks are cleared; large ones are cleared only as far as
+ * they may hold old data, so fresh pages are never touched.
+ */
+void*
+opt_calloc(size_t count, size_t size)
+{
+	size_t total;
+	if (__builtin_mul_overflow(count, size, &total) || total > PTRDIFF_MAX) {
+		return 0;
+	}
+
+	if (medium_chunk_size(total) <= MEDIUM_MAX) {
+		void* item = opt_malloc(total);
+		if (item != 0) {
+			memset(item, 0, total);
+		}
+		return item;
+	}
+
+	size_t dirty;
+	void* item = large_alloc(total, &dirty);
+	if (item != 0) {
+		memset(item, 0, dirty < total ? dirty : total);
+	}
+	return item;
+}
+
+/**
+ * Allocates up to n objects of size bytes each into out and returns how
+ * many it got, fewer only when memory runs out. Small objects come from
+ * the calling thread's cache, refilled once with everything still
+ * wanted, so they are mostly adjacent slots in address order; medium
+ * chunks are taken under a single lock acquisition.
+ */
+size_t
+opt_malloc_batch(size_t size, size_t n, void** out)
+{
+	size_t got = 0;
+	if (size <= SMALL_MAX) {
+		int cls = opt_request_class(size);
+		tcache* heap = heap_acquire(HM_LOCK_MALLOC);
+		class_bin* bin = &(heap->fast.bins[cls]);
+		while (got < n) {
+			if (bin->head == 0) {
+				cache_refill(heap, cls, n - got);
+				if (bin->head == 0) {
+					break;
+				}
+			}
+			out[got++] = bin->head;
+			bin->head = *((void**) bin->head);
+			bin->count -= 1;
+		}
+		stat_add(&(heap->fast.allocs), got);
+		heap_release(heap);
+		return got;
+	}
+
+	size_t chunk = medium_chunk_size(size);
+	if (size > PTRDIFF_MAX || chunk > MEDIUM_MAX) {
+		while (got < n && (out[got] = opt_malloc(size)) != 0) {
+			got += 1;
+		}
+		return got;
+	}
+
+	mutex_lock(HM_LOCK_MALLOC);
+	while (got < n) {
+		header* h = take_chunk(chunk);
+		if (h == 0) {
+			break;
+		}
+		out[got++] = ((void*) h) + sizeof(size_t);
+	}
+	stat_add(&stats.chunks_allocated, got);
+	pthread_mutex_unlock(&mutex);
+	return got;
+}
+
+/**
+ * Frees the n pointers in items, any of which may be 0. Small objects go
+ * to the calling thread's cache, acquired once, and the rest are freed
+ * under a single lock acquisition.
+ */
+void
+opt_free_batch(void** items, size_t n)
+{
+	bool chunks = false;
+	tcache* heap = heap_acquire(HM_LOCK_FREE);
+	for (size_t ii = 0; ii < n; ++ii) {
+		void* item = items[ii];
+		if (item == 0) {
+			continue;
+		}
+		int kind = region_kind(item);
+		if (kind == SB_SLAB) {
+			slab_page* page = slab_page_of(item);
+			if (page->owner == heap) {
+				cache_free(heap, page->cls, item);
+			} else {
+				stat_add(&(heap->fast.frees), 1);
+				remote_free(page->owner, item);
+			}
+		} else if (kind == SB_RUN) {
+			cache_free(heap, run_class(item), item);
+		} else {
+			chunks = true;
+		}
+	}
+	heap_release(heap);
+	if (!chunks) {
+		return;
+	}
+
+	mutex_lock(HM_LOCK_FREE);
+	scavenge_maybe();
+	for (size_t ii = 0; ii < n; ++ii) {
+		int kind = region_kind(items[ii]);
+		if (items[ii] != 0 && (kind == SB_MEDIUM || kind == SB_UNUSED)) {
+			chunk_free(items[ii]);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Makes the given arena block the one allocations bump through, past
+ * its first skip bytes.
+ */
+static
+void
+arena_enter(opt_arena* arena, arena_block* block, size_t skip)
+{
+	arena->cur = block;
+	arena->next = ((void*) block) + sizeof(arena_block) + skip;
+	arena->end = ((void*) block) + block->size;
+}
+
+/**
+ * Moves the arena on to a block with room for size bytes: the next one
+ * kept from before the last reset that fits, or a new one on the end of
+ * the chain.
+ */
+static
+bool
+arena_grow(opt_arena* arena, size_t size)
+{
+	for (arena_block* block = arena->cur->next; block != 0; block = block->next) {
+		if (block->size - sizeof(arena_block) >= size) {
+			arena_enter(arena, block, 0);
+			return true;
+		}
+	}
+
+	size_t bytes = 2 * arena->last->size;
+	if (bytes > ARENA_MAX_BLOCK) {
+		bytes = ARENA_MAX_BLOCK;
+	}
+	if (bytes < size + sizeof(arena_block)) {
+		bytes = size + sizeof(arena_block);
+	}
+	arena_block* block = (arena_block*) opt_malloc(bytes);
+	if (block == 0) {
+		return false;
+	}
+	block->next = 0;
+	block->size = bytes;
+	arena->last->next = block;
+	arena->last = block;
+	arena_enter(arena, block, 0);
+	return true;
+}
+
+/**
+ * Creates an empty arena. Returns 0 if out of memory.
+ */
+opt_arena*
+opt_arena_create()
+{
+	arena_block* block = (arena_block*) opt_malloc(ARENA_MIN_BLOCK);
+	if (block == 0) {
+		return 0;
+	}
+	block->next = 0;
+	block->size = ARENA_MIN_BLOCK;
+
+	opt_arena* arena = (opt_arena*) (((void*) block) + sizeof(arena_block));
+	arena->first = block;
+	arena->last = block;
+	arena_enter(arena, block, ARENA_SELF);
+	return arena;
+}
+
+/**
+ * Allocates size bytes, 16-byte aligned, from the given arena. The
+ * memory stays valid until the arena is reset or destroyed.
+ */
+void*
+opt_arena_alloc(opt_arena* arena, size_t size)
+{
+	if (size > PTRDIFF_MAX) {
+		return 0;
+	}
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (size > (size_t) (arena->end - arena->next) && !arena_grow(arena, size)) {
+		return 0;
+	}
+	void* item = arena->next;
+	arena->next += size;
+	return item;
+}
+
+/**
+ * Frees everything allocated from the given arena at once, keeping its
+ * blocks for the allocations that follow.
+ */
+void
+opt_arena_reset(opt_arena* arena)
+{
+	arena_enter(arena, arena->first, ARENA_SELF);
+}
+
+/**
+ * Frees the given arena, with everything allocated from it.
+ */
+void
+opt_arena_destroy(opt_arena* arena)
+{
+	arena_block* block = arena->first;
+	while (block != 0) {
+		arena_block* next = block->next;
+		opt_free_sized(block, block->size);
+		block = next;
+	}
+}
+
+#ifdef OPT_PROFILE
+
+#undef opt_malloc
+#undef opt_free
+#undef opt_realloc
+#undef opt_free_sized
+
+void*
+opt_malloc(size_t size)
+{
+	uint64_t start = prof_clock();
+	void* item = untimed_malloc(size);
+	prof_record(PROF_MALLOC, start, size);
+	return item;
+}
+
+void
+opt_free(void* item)
+{
+	uint64_t start = prof_clock();
+	untimed_free(item);
+	prof_record(PROF_FREE, start, 0);
+}
+
+void
+opt_free_sized(void* item, size_t size)
+{
+	uint64_t start = prof_clock();
+	untimed_free_sized(item, size);
+	prof_record(PROF_FREE, start, 0);
+}
+
+void*
+opt_realloc(void* prev, size_t size)
+{
+	uint64_t start = prof_clock();
+	void* item = untimed_realloc(prev, size);
+	prof_record(PROF_REALLOC, start, size);
+	return item;
+}
+
+#endif
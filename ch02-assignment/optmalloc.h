@@ -3,20 +3,176 @@
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Lock counters, one set per call site. Only filled in when optmalloc
+// is built with OPT_LOCKSTAT; heap locks exist only with OPT_PERCPU.
+#define HM_LOCK_MALLOC  0
+#define HM_LOCK_FREE    1
+#define HM_LOCK_REALLOC 2
+#define HM_LOCK_REFILL  3
+#define HM_LOCK_OTHER   4
+#define HM_LOCK_SITES   5
+
+typedef struct hm_lock_stats {
+    long acquired;
+    long contended;
+    long wait_ns;
+} hm_lock_stats;
+
 typedef struct hm_stats {
     long pages_mapped;
     long pages_unmapped;
     long chunks_allocated;
     long chunks_freed;
     long free_length;
+    long span_hits;
+    long span_cached_bytes;
+    long scavenged_bytes;
+    long huge_bytes;
+    hm_lock_stats mutex_locks[HM_LOCK_SITES];
+    hm_lock_stats heap_locks[HM_LOCK_SITES];
 } hm_stats;
 
 hm_stats* hgetstats();
 void hprintstats();
 
+// Only filled in when optmalloc is built with OPT_PROFILE.
+#define HM_SIZE_BUCKETS 48
+
+typedef struct hm_latency {
+    long calls;
+    long p50;
+    long p99;
+    long p999;
+} hm_latency;
+
+typedef struct hm_profile {
+    long sizes[HM_SIZE_BUCKETS];
+    hm_latency mallocs;
+    hm_latency frees;
+    hm_latency reallocs;
+} hm_profile;
+
+hm_profile* hgetprofile();
+void hprintprofile();
+
 
 void* opt_malloc(size_t size);
 void opt_free(void* item);
+void opt_free_sized(void* item, size_t size);
 void* opt_realloc(void* prev, size_t size);
+void* opt_memalign(size_t align, size_t size);
+void* opt_aligned_alloc(size_t align, size_t size);
+void* opt_calloc(size_t count, size_t size);
+size_t opt_usable_size(void* item);
+size_t opt_malloc_batch(size_t size, size_t n, void** out);
+void opt_free_batch(void** items, size_t n);
+
+typedef struct opt_arena opt_arena;
+
+opt_arena* opt_arena_create();
+void* opt_arena_alloc(opt_arena* arena, size_t size);
+void opt_arena_reset(opt_arena* arena);
+void opt_arena_destroy(opt_arena* arena);
+
+/*
+ * The common case of opt_malloc and opt_free_sized, inlined into the
+ * caller: a small object taken from or given back to the calling
+ * thread's cache bin. An empty or full bin, a larger size or a thread
+ * with no heap yet falls through to the out-of-line entry point, which
+ * refills or trims the bin. opt_fast_heap is the calling thread's heap;
+ * it stays null in OPT_PERCPU, OPT_PROFILE and OPT_DEBUG builds, so
+ * callers there always take the out-of-line path.
+ *
+ * These mirror optmalloc.c's own definitions, which check that they
+ * agree.
+ */
+#define OPT_CLASSES     20
+#define OPT_SLAB_MAX    64
+#define OPT_SMALL_MAX   1024
+#define OPT_CACHE_LIMIT 64
+#define OPT_PAGE_SIZE   4096
+#define OPT_SLAB_OWNER  48
+
+typedef struct opt_bin {
+    void* head;
+    long count;
+} opt_bin;
+
+typedef struct opt_heap {
+    opt_bin bins[OPT_CLASSES];
+    long allocs;
+    long frees;
+} opt_heap;
+
+extern __thread opt_heap* opt_fast_heap;
+
+/**
+ * Returns the class opt_malloc serves a request of the given size from,
+ * or OPT_CLASSES for medium and large requests.
+ */
+static inline __attribute__((always_inline))
+int
+opt_request_class(size_t size)
+{
+    if (size <= 128) {
+        return size == 0 ? 0 : (size - 1) / 16;
+    }
+    if (size > OPT_SMALL_MAX) {
+        return OPT_CLASSES;
+    }
+    int lg = 63 - __builtin_clzl(size - 1);
+    return 8 + (lg - 7) * 4 + ((size - 1 - (1UL << lg)) >> (lg - 2));
+}
+
+static inline __attribute__((always_inline))
+void*
+opt_malloc_fast(size_t size)
+{
+    opt_heap* heap = opt_fast_heap;
+    if (heap != 0 && size <= OPT_SMALL_MAX) {
+        opt_bin* bin = &(heap->bins[opt_request_class(size)]);
+        void* item = bin->head;
+        if (item != 0) {
+            bin->head = *((void**) item);
+            bin->count -= 1;
+            __atomic_store_n(&(heap->allocs), heap->allocs + 1, __ATOMIC_RELAXED);
+            return item;
+        }
+    }
+    return opt_malloc(size);
+}
+
+/**
+ * Slab objects (OPT_SLAB_MAX bytes and under) go back to the cache only
+ * when the calling thread's heap owns their page, which the page header
+ * records at OPT_SLAB_OWNER.
+ */
+static inline __attribute__((always_inline))
+void
+opt_free_sized_fast(void* item, size_t size)
+{
+    opt_heap* heap = opt_fast_heap;
+    if (heap != 0 && item != 0 && size <= OPT_SMALL_MAX) {
+        char* page = (char*) ((size_t) item & ~(size_t) (OPT_PAGE_SIZE - 1));
+        opt_bin* bin = &(heap->bins[opt_request_class(size)]);
+        if ((size > OPT_SLAB_MAX || *((opt_heap**) (page + OPT_SLAB_OWNER)) == heap)
+                && bin->count < OPT_CACHE_LIMIT) {
+            *((void**) item) = bin->head;
+            bin->head = item;
+            bin->count += 1;
+            __atomic_store_n(&(heap->frees), heap->frees + 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    opt_free_sized(item, size);
+}
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
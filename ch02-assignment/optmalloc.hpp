@@ -0,0 +1,69 @@
+#ifndef OPT_MALLOC_HPP
+#define OPT_MALLOC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "optmalloc.h"
+
+namespace optmalloc {
+
+// An allocator for the standard containers that takes memory from
+// optmalloc's size classes. Deallocation passes the container's known
+// size to opt_free_sized, so small objects are freed without looking
+// them up. Types aligned past 16 bytes come from opt_memalign, whose
+// pointers must go back through opt_free.
+template <class T>
+struct allocator {
+    typedef T value_type;
+
+    allocator() noexcept {}
+
+    template <class U>
+    allocator(const allocator<U>&) noexcept {}
+
+    T*
+    allocate(std::size_t nn)
+    {
+        if (nn > PTRDIFF_MAX / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void* ptr = alignof(T) > 16
+            ? opt_memalign(alignof(T), nn * sizeof(T))
+            : opt_malloc(nn * sizeof(T));
+        if (ptr == 0) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void
+    deallocate(T* ptr, std::size_t nn) noexcept
+    {
+        if (alignof(T) > 16) {
+            opt_free(ptr);
+        }
+        else {
+            opt_free_sized(ptr, nn * sizeof(T));
+        }
+    }
+};
+
+template <class T, class U>
+bool
+operator==(const allocator<T>&, const allocator<U>&) noexcept
+{
+    return true;
+}
+
+template <class T, class U>
+bool
+operator!=(const allocator<T>&, const allocator<U>&) noexcept
+{
+    return false;
+}
+
+}
+
+#endif
@@ -0,0 +1,162 @@
+
+// Replacement global operator new and delete over optmalloc. Linking
+// this into a C++ program sends every new expression, and the default
+// std::allocator, to optmalloc's size classes.
+//
+// Sized deletes hand the size the compiler already knows to
+// opt_free_sized. Aligned news come from opt_memalign, whose pointers
+// can only be freed with opt_free, so aligned deletes ignore the size.
+
+#include <cstddef>
+#include <new>
+
+#include "optmalloc.h"
+
+static
+void*
+new_or_throw(std::size_t bytes, std::size_t align)
+{
+    while (true) {
+        void* ptr = align > 16 ? opt_memalign(align, bytes) : opt_malloc(bytes);
+        if (ptr != 0) {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == 0) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+static
+void*
+new_or_null(std::size_t bytes, std::size_t align) noexcept
+{
+    try {
+        return new_or_throw(bytes, align);
+    }
+    catch (...) {
+        return 0;
+    }
+}
+
+void*
+operator new(std::size_t bytes)
+{
+    return new_or_throw(bytes, 0);
+}
+
+void*
+operator new[](std::size_t bytes)
+{
+    return new_or_throw(bytes, 0);
+}
+
+void*
+operator new(std::size_t bytes, const std::nothrow_t&) noexcept
+{
+    return new_or_null(bytes, 0);
+}
+
+void*
+operator new[](std::size_t bytes, const std::nothrow_t&) noexcept
+{
+    return new_or_null(bytes, 0);
+}
+
+void*
+operator new(std::size_t bytes, std::align_val_t align)
+{
+    return new_or_throw(bytes, static_cast<std::size_t>(align));
+}
+
+void*
+operator new[](std::size_t bytes, std::align_val_t align)
+{
+    return new_or_throw(bytes, static_cast<std::size_t>(align));
+}
+
+void*
+operator new(std::size_t bytes, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    return new_or_null(bytes, static_cast<std::size_t>(align));
+}
+
+void*
+operator new[](std::size_t bytes, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    return new_or_null(bytes, static_cast<std::size_t>(align));
+}
+
+void
+operator delete(void* ptr) noexcept
+{
+    opt_free(ptr);
+}
+
+void
+operator delete[](void* ptr) noexcept
+{
+    opt_free(ptr);
+}
+
+void
+operator delete(void* ptr, std::size_t bytes) noexcept
+{
+    opt_free_sized(ptr, bytes);
+}
+
+void
+operator delete[](void* ptr, std::size_t bytes) noexcept
+{
+    opt_free_sized(ptr, bytes);
+}
+
+void
+operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    opt_free(ptr);
+}
+
+void
+operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    opt_free(ptr);
+}
+
+void
+operator delete(void* ptr, std::align_val_t) noexcept
+{
+    opt_free(ptr);
+}
+
+void
+operator delete[](void* ptr, std::align_val_t) noexcept
+{
+    opt_free(ptr);
+}
+
+void
+operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+    opt_free(ptr);
+}
+
+void
+operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept
+{
+    opt_free(ptr);
+}
+
+void
+operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    opt_free(ptr);
+}
+
+void
+operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    opt_free(ptr);
+}
@@ -4,6 +4,7 @@
 #include <unistd.h>
 
 #include "xmalloc.h"
+#include "xarena.h"
 #include "optmalloc.h"
 
 void*
@@ -18,9 +19,50 @@ xfree(void* ptr)
     opt_free(ptr);
 }
 
+void
+xfree_sized(void* ptr, size_t bytes)
+{
+    opt_free_sized(ptr, bytes);
+}
+
 void*
 xrealloc(void* prev, size_t bytes)
 {
     return opt_realloc(prev, bytes);
 }
 
+size_t
+xmalloc_batch(size_t bytes, size_t nn, void** out)
+{
+    return opt_malloc_batch(bytes, nn, out);
+}
+
+void
+xfree_batch(void** ptrs, size_t nn)
+{
+    opt_free_batch(ptrs, nn);
+}
+
+xarena*
+xarena_create()
+{
+    return (xarena*) opt_arena_create();
+}
+
+void*
+xarena_alloc(xarena* arena, size_t bytes)
+{
+    return opt_arena_alloc((opt_arena*) arena, bytes);
+}
+
+void
+xarena_reset(xarena* arena)
+{
+    opt_arena_reset((opt_arena*) arena);
+}
+
+void
+xarena_destroy(xarena* arena)
+{
+    opt_arena_destroy((opt_arena*) arena);
+}
@@ -0,0 +1,147 @@
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "optmalloc.h"
+
+/*
+ * The libc allocation functions on top of optmalloc, for building
+ * liboptmalloc.so and loading it into unmodified programs with
+ * LD_PRELOAD. optmalloc never allocates through malloc itself and never
+ * looks anything up with dlsym, so these are safe to call from the
+ * dynamic loader and libc before main, and from inside a dlsym call.
+ * The library is built with hidden visibility; only these are exported.
+ */
+#define EXPORT __attribute__((visibility("default")))
+
+static
+void*
+fail(int err)
+{
+    errno = err;
+    return 0;
+}
+
+static
+int
+power_of_two(size_t xx)
+{
+    return xx != 0 && (xx & (xx - 1)) == 0;
+}
+
+EXPORT
+void*
+malloc(size_t bytes)
+{
+    void* ptr = opt_malloc(bytes);
+    return ptr != 0 ? ptr : fail(ENOMEM);
+}
+
+EXPORT
+void
+free(void* ptr)
+{
+    opt_free(ptr);
+}
+
+// C23 free_sized and free_aligned_sized, for programs built against a
+// libc that has them.
+EXPORT
+void
+free_sized(void* ptr, size_t bytes)
+{
+    opt_free_sized(ptr, bytes);
+}
+
+EXPORT
+void
+free_aligned_sized(void* ptr, size_t align, size_t bytes)
+{
+    opt_free(ptr);
+}
+
+EXPORT
+void*
+calloc(size_t count, size_t bytes)
+{
+    void* ptr = opt_calloc(count, bytes);
+    return ptr != 0 ? ptr : fail(ENOMEM);
+}
+
+EXPORT
+void*
+realloc(void* prev, size_t bytes)
+{
+    // like glibc, realloc to zero bytes frees.
+    if (prev != 0 && bytes == 0) {
+        opt_free(prev);
+        return 0;
+    }
+    void* ptr = opt_realloc(prev, bytes);
+    return ptr != 0 ? ptr : fail(ENOMEM);
+}
+
+EXPORT
+int
+posix_memalign(void** out, size_t align, size_t bytes)
+{
+    if (!power_of_two(align) || align % sizeof(void*) != 0) {
+        return EINVAL;
+    }
+    void* ptr = opt_memalign(align, bytes);
+    if (ptr == 0) {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+EXPORT
+void*
+aligned_alloc(size_t align, size_t bytes)
+{
+    if (!power_of_two(align)) {
+        return fail(EINVAL);
+    }
+    void* ptr = opt_aligned_alloc(align, bytes);
+    return ptr != 0 ? ptr : fail(ENOMEM);
+}
+
+EXPORT
+void*
+memalign(size_t align, size_t bytes)
+{
+    // like glibc, round other alignments up to a power of two.
+    while (!power_of_two(align)) {
+        align = align == 0 ? 1 : (align | (align - 1)) + 1;
+    }
+    void* ptr = opt_memalign(align, bytes);
+    return ptr != 0 ? ptr : fail(ENOMEM);
+}
+
+EXPORT
+void*
+valloc(size_t bytes)
+{
+    return memalign(sysconf(_SC_PAGESIZE), bytes);
+}
+
+EXPORT
+void*
+pvalloc(size_t bytes)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    if (bytes > SIZE_MAX - page) {
+        return fail(ENOMEM);
+    }
+    return memalign(page, (bytes + page - 1) & ~(page - 1));
+}
+
+EXPORT
+size_t
+malloc_usable_size(void* ptr)
+{
+    return opt_usable_size(ptr);
+}
@@ -0,0 +1,74 @@
+#!/usr/bin/perl
+use 5.16.0;
+use warnings FATAL => 'all';
+use POSIX ":sys_wait_h";
+
+use Time::HiRes qw(sleep);
+
+# Runs every sweep-{list,ivec}-{sys,hw7,par} binary over a grid of TOP
+# values and thread counts, several times each, and prints one CSV row
+# per run. The grid can be changed through the environment:
+#
+#   SWEEP_TOPS="1000 10000" SWEEP_THREADS="1 4" SWEEP_REPS=5 perl sweep.pl
+#
+# A run that takes longer than SWEEP_TIMEOUT seconds is killed and
+# reported as a timeout, with no measurements. Later runs of the same
+# binary and thread count, which would only be as slow or slower, are
+# reported as skipped.
+
+my @progs   = map { my $kk = $_; map { "sweep-$kk-$_" } qw(sys hw7 par) }
+              qw(list ivec);
+my @tops    = split ' ', ($ENV{SWEEP_TOPS} // "1000 10000 100000");
+my @threads = split ' ', ($ENV{SWEEP_THREADS} // "1 2 4 8");
+my $reps    = $ENV{SWEEP_REPS} // 3;
+my $timeout = $ENV{SWEEP_TIMEOUT} // 60;
+
+sub run_prog {
+    my ($prog, $top, $nthreads) = @_;
+    system("rm -f sweep.tmp");
+
+    my $cpid = fork();
+    if ($cpid == 0) {
+        open(STDOUT, '>', "sweep.tmp") or die "sweep.tmp: $!";
+        exec("./$prog", $top, $nthreads) or die "$prog: $!";
+    }
+
+    my $waited = 0;
+    while (waitpid($cpid, WNOHANG) == 0) {
+        sleep 0.05;
+        $waited += 0.05;
+        if ($waited > $timeout) {
+            kill('KILL', $cpid);
+            waitpid($cpid, 0);
+            return ("timeout", "", ("") x 6);
+        }
+    }
+    my $code = $?;
+
+    my $outp = `cat sweep.tmp`;
+    my ($result) = $outp =~ /^Max steps is at (\d+: \d+) steps$/m;
+    my ($usage)  = $outp =~ /^Resources: (.*)$/m;
+    if ($code != 0 || !defined($result) || !defined($usage)) {
+        return ("failed", "", ("") x 6);
+    }
+    return ("ok", $result, split(/,/, $usage));
+}
+
+my %timed_out;
+
+say "prog,top,threads,rep,status,result,wall_s,user_s,sys_s,maxrss_kb,minflt,majflt";
+for my $prog (@progs) {
+    for my $top (@tops) {
+        for my $nthreads (@threads) {
+            for my $rep (1..$reps) {
+                my @row = ("skipped", "", ("") x 6);
+                if (!$timed_out{"$prog $nthreads"}) {
+                    @row = run_prog($prog, $top, $nthreads);
+                    $timed_out{"$prog $nthreads"} = $row[0] eq "timeout";
+                }
+                say join(",", $prog, $top, $nthreads, $rep, @row);
+            }
+        }
+    }
+}
+system("rm -f sweep.tmp");
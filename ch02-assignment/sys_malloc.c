@@ -18,9 +18,31 @@ xfree(void* ptr)
     free(ptr);
 }
 
+void
+xfree_sized(void* ptr, size_t bytes)
+{
+    free(ptr);
+}
+
 void*
 xrealloc(void* prev, size_t bytes)
 {
     return realloc(prev, bytes);
 }
 
+size_t
+xmalloc_batch(size_t bytes, size_t nn, void** out)
+{
+    for (size_t ii = 0; ii < nn; ++ii) {
+        out[ii] = malloc(bytes);
+    }
+    return nn;
+}
+
+void
+xfree_batch(void** ptrs, size_t nn)
+{
+    for (size_t ii = 0; ii < nn; ++ii) {
+        free(ptrs[ii]);
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef XARENA_H
+#define XARENA_H
+
+#include <stddef.h>
+
+// Region allocation: memory from an arena is never freed on its own,
+// only all at once by resetting or destroying the arena. Only the par
+// allocator provides these.
+
+typedef struct xarena xarena;
+
+xarena* xarena_create();
+void* xarena_alloc(xarena* arena, size_t bytes);
+void  xarena_reset(xarena* arena);
+void  xarena_destroy(xarena* arena);
+
+#endif
@@ -3,8 +3,36 @@
 
 #include <stddef.h>
 
+// With OPT_INLINE defined, xmalloc and xfree_sized are optmalloc's
+// inline fast paths instead of calls into the allocator backend.
+#ifdef OPT_INLINE
+
+#include "optmalloc.h"
+
+static inline __attribute__((always_inline))
+void*
+xmalloc(size_t bytes)
+{
+    return opt_malloc_fast(bytes);
+}
+
+static inline __attribute__((always_inline))
+void
+xfree_sized(void* ptr, size_t bytes)
+{
+    opt_free_sized_fast(ptr, bytes);
+}
+
+#else
+
 void* xmalloc(size_t bytes);
+void  xfree_sized(void* ptr, size_t bytes);
+
+#endif
+
 void  xfree(void* ptr);
 void* xrealloc(void* prev, size_t bytes);
+size_t xmalloc_batch(size_t bytes, size_t nn, void** out);
+void  xfree_batch(void** ptrs, size_t nn);
 
 #endif